@@ -0,0 +1,629 @@
+#include "provided.h"
+#include "Trie.h"
+#include "RadixTrie.h"
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <new>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+#if defined(_WIN32)
+#include <windows.h>
+#include <psapi.h>
+#include <malloc.h>
+#pragma comment(lib, "psapi.lib")
+#else
+#include <unistd.h>
+#if defined(__APPLE__)
+#include <malloc/malloc.h>
+#else
+#include <malloc.h>
+#endif
+#endif
+using namespace std;
+
+// Benchmarks the genome library on the provided data files. Every result is printed to cout as
+// one JSON object per line so that runs can be diffed and tracked over time; progress and
+// warnings go to cerr.
+//
+// usage: Benchmark [--dir DIR] [--k K1,K2,...] [--queries N] [--seed S] [--snp-related] [--max-ns N]
+//                  [--max-occurrences N] [--freeze] [--trie-layout] [--stride N] [--prefilter N]
+//
+// --trie-layout skips the library benchmarks and instead compares Trie with RadixTrie on every
+// k-mer of the loaded genomes.
+
+const string providedFiles[] = {
+	"Ferroplasma_acidarmanus.txt",
+	"Halobacterium_jilantaiense.txt",
+	"Halorubrum_chaoviator.txt",
+	"Halorubrum_californiense.txt",
+	"Halorientalis_regularis.txt",
+	"Halorientalis_persicus.txt",
+	"Ferroglobus_placidus.txt",
+	"Desulfurococcus_mucosus.txt"
+};
+
+struct Options {
+	string dir = "../Project4";
+	vector<int> minSearchLengths = { 10, 12 };
+	int queries = 1000;
+	unsigned seed = 1;
+	bool snpRelated = false;
+	int maxIndexedNs = -1;
+	int maxSeedOccurrences = 0;
+	bool freeze = false;
+	bool trieLayout = false;
+	int fragmentStride = 0;
+	int prefilterSample = 0;
+};
+
+struct DataFile {
+	string name;
+	vector<Genome> genomes;
+};
+
+struct Place {	// what benchTrieLayout maps each k-mer to
+	int genome;
+	int position;
+};
+
+typedef chrono::steady_clock Clock;
+
+//=================================================================================================
+//	operator new / operator delete
+//	count every heap allocation made by this process in g_allocations so that benchmarks can report
+//	how many allocations a query makes, and the bytes held by live allocations in g_heapBytes so
+//	that they can report how much memory a structure takes. g_peakHeapBytes is the most g_heapBytes
+//	has been since resetPeakHeap, so that a step's peak is its own and not the process's. Every
+//	replaceable form, plain, array, sized and nothrow, goes through countedAllocate and countedFree,
+//	so no allocation path is missed and every pointer is freed by the allocator that made it
+//=================================================================================================
+atomic<long long> g_allocations(0);
+atomic<long long> g_heapBytes(0);
+atomic<long long> g_peakHeapBytes(0);
+
+size_t allocationSize(void *p) {
+#if defined(_WIN32)
+	return _msize(p);
+#elif defined(__APPLE__)
+	return malloc_size(p);
+#else
+	return malloc_usable_size(p);
+#endif
+}
+
+void* countedAllocate(size_t size) noexcept {
+	g_allocations.fetch_add(1, memory_order_relaxed);
+	void *p = malloc(size == 0 ? 1 : size);
+	if (p == nullptr)
+		return p;
+	long long bytes = allocationSize(p);
+	long long live = g_heapBytes.fetch_add(bytes, memory_order_relaxed) + bytes;
+	long long peak = g_peakHeapBytes.load(memory_order_relaxed);
+	while (live > peak && !g_peakHeapBytes.compare_exchange_weak(peak, live, memory_order_relaxed))
+		;
+	return p;
+}
+
+void resetPeakHeap() {
+	g_peakHeapBytes.store(g_heapBytes.load(memory_order_relaxed), memory_order_relaxed);
+}
+
+void countedFree(void *p) noexcept {
+	if (p != nullptr)
+		g_heapBytes.fetch_sub(allocationSize(p), memory_order_relaxed);
+	free(p);
+}
+
+void* operator new(size_t size) {
+	if (void *p = countedAllocate(size))
+		return p;
+	throw bad_alloc();
+}
+
+void* operator new[](size_t size) {
+	if (void *p = countedAllocate(size))
+		return p;
+	throw bad_alloc();
+}
+
+void* operator new(size_t size, const nothrow_t&) noexcept {
+	return countedAllocate(size);
+}
+
+void* operator new[](size_t size, const nothrow_t&) noexcept {
+	return countedAllocate(size);
+}
+
+void operator delete(void *p) noexcept {
+	countedFree(p);
+}
+
+void operator delete[](void *p) noexcept {
+	countedFree(p);
+}
+
+void operator delete(void *p, size_t) noexcept {
+	countedFree(p);
+}
+
+void operator delete[](void *p, size_t) noexcept {
+	countedFree(p);
+}
+
+void operator delete(void *p, const nothrow_t&) noexcept {
+	countedFree(p);
+}
+
+void operator delete[](void *p, const nothrow_t&) noexcept {
+	countedFree(p);
+}
+
+//=================================================================================================
+//	double secondsSince
+//	returns the number of seconds elapsed since start
+//=================================================================================================
+double secondsSince(Clock::time_point start) {
+	return chrono::duration<double>(Clock::now() - start).count();
+}
+
+//=================================================================================================
+//	long long currentRssKb
+//	returns the resident set size of this process in kilobytes, or -1 if it cannot be determined
+//	on this platform
+//=================================================================================================
+long long currentRssKb() {
+#if defined(_WIN32)
+	PROCESS_MEMORY_COUNTERS pmc;
+	if (!GetProcessMemoryInfo(GetCurrentProcess(), &pmc, sizeof(pmc)))
+		return -1;
+	return pmc.WorkingSetSize / 1024;
+#else
+	ifstream statm("/proc/self/statm");
+	long long pages, resident;
+	if (!(statm >> pages >> resident))
+		return -1;
+	return resident * (sysconf(_SC_PAGESIZE) / 1024);
+#endif
+}
+
+//=================================================================================================
+//	string jsonString
+//	returns s as a quoted JSON string
+//=================================================================================================
+string jsonString(const string &s) {
+	string out = "\"";
+	for (char ch : s) {
+		if (ch == '"' || ch == '\\')
+			out += '\\';
+		if ((unsigned char)ch < 0x20)
+			continue;
+		out += ch;
+	}
+	return out + "\"";
+}
+
+//=================================================================================================
+//	class JsonLine
+//	builds and prints one line of output: {"bench":"...", "key":value, ...}
+//=================================================================================================
+class JsonLine {
+public:
+	JsonLine(const string &bench) { m_out << "{\"bench\":" << jsonString(bench); }
+	JsonLine& add(const string &key, const string &value) { m_out << "," << jsonString(key) << ":" << jsonString(value); return *this; }
+	JsonLine& add(const string &key, const char *value) { return add(key, string(value)); }
+	JsonLine& add(const string &key, long long value) { m_out << "," << jsonString(key) << ":" << value; return *this; }
+	JsonLine& add(const string &key, int value) { return add(key, (long long)value); }
+	JsonLine& add(const string &key, size_t value) { return add(key, (long long)value); }
+	JsonLine& add(const string &key, double value) { m_out << "," << jsonString(key) << ":" << value; return *this; }
+	JsonLine& add(const string &key, bool value) { m_out << "," << jsonString(key) << ":" << (value ? "true" : "false"); return *this; }
+	void print() { cout << m_out.str() << "}" << endl; }
+private:
+	ostringstream m_out;
+};
+
+//=================================================================================================
+//	void addLatencies
+//	adds count, mean and the 50th/90th/99th percentile and max of the latencies (in microseconds)
+//	to line
+//=================================================================================================
+void addLatencies(JsonLine &line, vector<double> latencies) {
+	line.add("count", latencies.size());
+	if (latencies.empty())
+		return;
+	sort(latencies.begin(), latencies.end());
+	double total = 0;
+	for (double l : latencies)
+		total += l;
+	auto percentile = [&latencies](double p) {
+		size_t index = (size_t)(p / 100 * (latencies.size() - 1) + 0.5);
+		return latencies[index];
+	};
+	line.add("mean_us", total / latencies.size())
+		.add("p50_us", percentile(50))
+		.add("p90_us", percentile(90))
+		.add("p99_us", percentile(99))
+		.add("max_us", latencies.back());
+}
+
+//=================================================================================================
+//	bool parseOptions
+//	fills opts from the command line. Returns false and prints usage if an argument is invalid
+//=================================================================================================
+bool parseOptions(int argc, char *argv[], Options &opts) {
+	for (int i = 1; i < argc; i++) {
+		string arg = argv[i];
+		bool hasValue = i + 1 < argc;
+		if (arg == "--dir" && hasValue)
+			opts.dir = argv[++i];
+		else if (arg == "--k" && hasValue) {
+			opts.minSearchLengths.clear();
+			stringstream list(argv[++i]);
+			string item;
+			while (getline(list, item, ','))
+				opts.minSearchLengths.push_back(atoi(item.c_str()));
+		}
+		else if (arg == "--queries" && hasValue)
+			opts.queries = atoi(argv[++i]);
+		else if (arg == "--seed" && hasValue)
+			opts.seed = (unsigned)atoi(argv[++i]);
+		else if (arg == "--snp-related")
+			opts.snpRelated = true;
+		else if (arg == "--max-ns" && hasValue)
+			opts.maxIndexedNs = atoi(argv[++i]);
+		else if (arg == "--max-occurrences" && hasValue)
+			opts.maxSeedOccurrences = atoi(argv[++i]);
+		else if (arg == "--freeze")
+			opts.freeze = true;
+		else if (arg == "--trie-layout")
+			opts.trieLayout = true;
+		else if (arg == "--stride" && hasValue)
+			opts.fragmentStride = atoi(argv[++i]);
+		else if (arg == "--prefilter" && hasValue)
+			opts.prefilterSample = atoi(argv[++i]);
+		else {
+			cerr << "usage: Benchmark [--dir DIR] [--k K1,K2,...] [--queries N] [--seed S] [--snp-related] [--max-ns N]" << endl;
+			cerr << "                 [--max-occurrences N] [--freeze] [--trie-layout] [--stride N]" << endl;
+			cerr << "                 [--prefilter N]" << endl;
+			return false;
+		}
+	}
+	for (int k : opts.minSearchLengths) {
+		if (k < 3 || k > 100) {
+			cerr << "Invalid minimum search length " << k << endl;
+			return false;
+		}
+	}
+	return opts.queries > 0 && !opts.minSearchLengths.empty();
+}
+
+//=================================================================================================
+//	void benchParse
+//	loads every provided file that exists into files, timing Genome::load on the file already read
+//	into memory so only parsing is measured, and Genome::loadFile on the file itself
+//=================================================================================================
+void benchParse(const Options &opts, vector<DataFile> &files) {
+	long long totalBytes = 0;
+	double totalSeconds = 0;
+	double totalFileSeconds = 0;
+
+	for (const string &f : providedFiles) {
+		ifstream inputf(opts.dir + "/" + f, ios::binary);
+		if (!inputf) {
+			cerr << "Skipping missing file: " << f << endl;
+			continue;
+		}
+		string contents((istreambuf_iterator<char>(inputf)), istreambuf_iterator<char>());
+		istringstream source(contents);
+
+		DataFile file;
+		file.name = f;
+		Clock::time_point start = Clock::now();
+		bool ok = Genome::load(source, file.genomes);
+		double seconds = secondsSince(start);
+
+		JsonLine("parse").add("file", f).add("ok", ok).add("bytes", contents.size())
+			.add("genomes", file.genomes.size()).add("seconds", seconds)
+			.add("gb_per_s", contents.size() / 1e9 / seconds).print();
+		if (!ok)
+			continue;
+		totalBytes += contents.size();
+		totalSeconds += seconds;
+
+		// the same file through the memory-mapped, parallel loader
+		vector<Genome> mapped;
+		start = Clock::now();
+		ok = Genome::loadFile(opts.dir + "/" + f, mapped);
+		seconds = secondsSince(start);
+		totalFileSeconds += seconds;
+		JsonLine("parse_mapped").add("file", f).add("ok", ok).add("bytes", contents.size())
+			.add("genomes", mapped.size()).add("seconds", seconds)
+			.add("gb_per_s", contents.size() / 1e9 / seconds).print();
+		files.push_back(file);
+	}
+
+	JsonLine("parse_total").add("bytes", totalBytes).add("seconds", totalSeconds)
+		.add("gb_per_s", totalBytes / 1e9 / totalSeconds).print();
+	JsonLine("parse_mapped_total").add("bytes", totalBytes).add("seconds", totalFileSeconds)
+		.add("gb_per_s", totalBytes / 1e9 / totalFileSeconds).print();
+}
+
+//=================================================================================================
+//	void benchNormalize
+//	times Genome::normalizeSequence on a lowercase copy of every loaded sequence
+//=================================================================================================
+void benchNormalize(const vector<const Genome*> &genomes) {
+	long long totalBytes = 0;
+	double totalSeconds = 0;
+	bool ok = true;
+
+	for (const Genome *g : genomes) {
+		string sequence;
+		g->extract(0, g->length(), sequence);
+		for (char &ch : sequence)
+			ch = tolower(ch);
+		Clock::time_point start = Clock::now();
+		ok = Genome::normalizeSequence(sequence) && ok;
+		totalSeconds += secondsSince(start);
+		totalBytes += sequence.size();
+	}
+
+	JsonLine("normalize").add("ok", ok).add("bytes", totalBytes).add("seconds", totalSeconds)
+		.add("gb_per_s", totalBytes / 1e9 / totalSeconds).print();
+}
+
+//=================================================================================================
+//	void makeFragments
+//	fills planted with count fragments copied from random places in the genomes, with snps random
+//	bases changed (never the first, which the library requires to match), and random with as many
+//	uniformly random fragments of the same lengths
+//=================================================================================================
+void makeFragments(const vector<const Genome*> &genomes, int minSearchLength, int snps, int count, mt19937 &rng, vector<string> &planted, vector<string> &random) {
+	const char bases[] = "ACGT";
+	planted.clear();
+	random.clear();
+
+	while ((int)planted.size() < count) {
+		const Genome &g = *genomes[rng() % genomes.size()];
+		int length = minSearchLength + rng() % (2 * minSearchLength + 1);
+		if (g.length() < length)
+			continue;
+		string fragment;
+		g.extract(rng() % (g.length() - length + 1), length, fragment);
+		for (int i = 0; i < snps; i++) {
+			int pos = 1 + rng() % (length - 1);
+			char changed;
+			do
+				changed = bases[rng() % 4];
+			while (changed == fragment[pos]);
+			fragment[pos] = changed;
+		}
+		planted.push_back(fragment);
+
+		string noise(length, 'A');
+		for (char &ch : noise)
+			ch = bases[rng() % 4];
+		random.push_back(noise);
+	}
+}
+
+//=================================================================================================
+//	void benchQueries
+//	times findGenomesWithThisDNA on planted and random fragments in exact and SNiP mode, asking
+//	for matches of at least k chars and then of the whole fragment
+//=================================================================================================
+void benchQueries(const Options &opts, const GenomeMatcher &library, const vector<const Genome*> &genomes, int k) {
+	mt19937 rng(opts.seed);
+
+	for (int exact = 1; exact >= 0; exact--) {
+		vector<string> planted, random;
+		makeFragments(genomes, k, exact ? 0 : 1, opts.queries, rng, planted, random);
+
+		const vector<string> *sets[] = { &planted, &random };
+		const char *setNames[] = { "planted", "random" };
+		for (int s = 0; s < 4; s++) {
+			bool whole = s >= 2;	// minimumLength is the fragment's length
+			const vector<string> &fragments = *sets[s % 2];
+			vector<double> latencies;
+			latencies.reserve(fragments.size());
+			size_t hits = 0;
+			long long allocations = 0;
+			for (const string &fragment : fragments) {
+				vector<DNAMatch> matches;
+				long long allocationsBefore = g_allocations.load(memory_order_relaxed);
+				Clock::time_point start = Clock::now();
+				if (library.findGenomesWithThisDNA(fragment, whole ? (int)fragment.size() : k, exact != 0, matches))
+					hits++;
+				latencies.push_back(secondsSince(start) * 1e6);
+				allocations += g_allocations.load(memory_order_relaxed) - allocationsBefore;
+			}
+			JsonLine line("find_dna");
+			line.add("k", k).add("mode", exact ? "exact" : "snp").add("fragments", setNames[s % 2])
+				.add("min_length", whole ? "fragment" : "k").add("hits", hits)
+				.add("allocs_per_query", fragments.empty() ? 0.0 : (double)allocations / fragments.size());
+			addLatencies(line, latencies);
+			line.print();
+		}
+	}
+}
+
+//=================================================================================================
+//	void benchCache
+//	times SNiP findGenomesWithThisDNA on a stream of planted fragments in which each fragment
+//	appears ten times, first with the result cache off and then with room for every fragment
+//=================================================================================================
+void benchCache(const Options &opts, GenomeMatcher &library, const vector<const Genome*> &genomes, int k) {
+	const int repeats = 10;
+	mt19937 rng(opts.seed);
+	vector<string> planted, random, stream;
+	makeFragments(genomes, k, 1, max(opts.queries / repeats, 1), rng, planted, random);
+	for (int r = 0; r < repeats; r++)
+		stream.insert(stream.end(), planted.begin(), planted.end());
+	shuffle(stream.begin(), stream.end(), rng);
+
+	for (int capacity : { 0, (int)planted.size() }) {
+		library.setResultCacheCapacity(capacity);
+		long long hitsBefore = library.resultCacheHits(), missesBefore = library.resultCacheMisses();
+		vector<double> latencies;
+		latencies.reserve(stream.size());
+		for (const string &fragment : stream) {
+			vector<DNAMatch> matches;
+			Clock::time_point start = Clock::now();
+			library.findGenomesWithThisDNA(fragment, k, false, matches);
+			latencies.push_back(secondsSince(start) * 1e6);
+		}
+		JsonLine line("find_dna_cache");
+		line.add("k", k).add("capacity", capacity).add("distinct", planted.size())
+			.add("cache_hits", library.resultCacheHits() - hitsBefore)
+			.add("cache_misses", library.resultCacheMisses() - missesBefore);
+		addLatencies(line, latencies);
+		line.print();
+	}
+	library.setResultCacheCapacity(0);
+}
+
+//=================================================================================================
+//	void benchRelated
+//	times findRelatedGenomes for every loaded genome against the whole library
+//=================================================================================================
+void benchRelated(const Options &opts, const GenomeMatcher &library, const vector<DataFile> &files, int k) {
+	for (int exact = 1; exact >= (opts.snpRelated ? 0 : 1); exact--) {
+		double totalSeconds = 0;
+		long long totalAllocations = 0;
+		for (const DataFile &file : files) {
+			for (const Genome &g : file.genomes) {
+				vector<GenomeMatch> results;
+				long long allocationsBefore = g_allocations.load(memory_order_relaxed);
+				Clock::time_point start = Clock::now();
+				library.findRelatedGenomes(g, 2 * k, exact != 0, 0, results);
+				double seconds = secondsSince(start);
+				long long allocations = g_allocations.load(memory_order_relaxed) - allocationsBefore;
+				totalSeconds += seconds;
+				totalAllocations += allocations;
+				JsonLine("find_related").add("k", k).add("mode", exact ? "exact" : "snp").add("stride", opts.fragmentStride)
+					.add("prefilter", opts.prefilterSample).add("file", file.name)
+					.add("genome", g.name()).add("length", g.length()).add("related", results.size())
+					.add("seconds", seconds).add("allocations", allocations).print();
+			}
+		}
+		JsonLine("find_related_total").add("k", k).add("mode", exact ? "exact" : "snp").add("stride", opts.fragmentStride)
+			.add("prefilter", opts.prefilterSample).add("seconds", totalSeconds)
+			.add("allocations", totalAllocations).print();
+	}
+}
+
+//=================================================================================================
+//	void benchTrieLayout
+//	maps every k-mer of the genomes to its place in a Tree, reporting how many nodes and how much
+//	heap that takes, then times finding planted k-mers with up to one mismatch
+//=================================================================================================
+template<typename Tree>
+void benchTrieLayout(const Options &opts, const char *layout, const vector<const Genome*> &genomes, int k) {
+	long long heapBefore = g_heapBytes.load(memory_order_relaxed);
+	long long allocationsBefore = g_allocations.load(memory_order_relaxed);
+	Clock::time_point start = Clock::now();
+	Tree *tree = new Tree;
+	string kmer;
+	for (size_t i = 0; i < genomes.size(); i++) {
+		for (int pos = 0; pos + k <= genomes[i]->length(); pos++) {
+			genomes[i]->extract(pos, k, kmer);
+			tree->insert(kmer, Place{ (int)i, pos });
+		}
+	}
+	double seconds = secondsSince(start);
+	long long allocations = g_allocations.load(memory_order_relaxed) - allocationsBefore;
+	long long heapKb = (g_heapBytes.load(memory_order_relaxed) - heapBefore) / 1024;
+
+	mt19937 rng(opts.seed);
+	vector<string> planted, random;
+	makeFragments(genomes, k, 1, opts.queries, rng, planted, random);
+	vector<double> latencies;
+	latencies.reserve(planted.size());
+	size_t found = 0;
+	for (const string &fragment : planted) {
+		start = Clock::now();
+		found += tree->find(fragment.substr(0, k), false).size();
+		latencies.push_back(secondsSince(start) * 1e6);
+	}
+
+	JsonLine line("trie_layout");
+	line.add("k", k).add("layout", layout).add("nodes", tree->nodeCount()).add("seconds", seconds)
+		.add("allocations", allocations).add("heap_kb", heapKb).add("found", found);
+	addLatencies(line, latencies);
+	line.print();
+	delete tree;
+}
+
+int main(int argc, char *argv[])
+{
+	Options opts;
+	if (!parseOptions(argc, argv, opts))
+		return 1;
+
+	vector<DataFile> files;
+	benchParse(opts, files);
+	vector<const Genome*> genomes;
+	long long totalBases = 0;
+	for (const DataFile &file : files) {
+		for (const Genome &g : file.genomes) {
+			genomes.push_back(&g);
+			totalBases += g.length();
+		}
+	}
+	if (genomes.empty()) {
+		cerr << "No genomes could be loaded from " << opts.dir << endl;
+		return 1;
+	}
+	benchNormalize(genomes);
+
+	for (int k : opts.minSearchLengths) {
+		if (opts.trieLayout) {
+			cerr << "Comparing trie layouts at k = " << k << endl;
+			benchTrieLayout<RadixTrie<Place>>(opts, "radix", genomes, k);
+			benchTrieLayout<Trie<Place>>(opts, "trie", genomes, k);
+			continue;
+		}
+
+		cerr << "Benchmarking minSearchLength " << k << endl;
+		long long rssBefore = currentRssKb();
+		long long heapBefore = g_heapBytes.load(memory_order_relaxed);
+		resetPeakHeap();
+		long long allocationsBefore = g_allocations.load(memory_order_relaxed);
+		GenomeMatcher *library = new GenomeMatcher(k);
+		library->setMaxIndexedNs(opts.maxIndexedNs);
+		library->setMaxSeedOccurrences(opts.maxSeedOccurrences);
+		library->setFragmentStride(opts.fragmentStride);
+		library->setRelatedPrefilter(opts.prefilterSample);
+		Clock::time_point start = Clock::now();
+		for (const Genome *g : genomes)
+			library->addGenome(*g);
+		double seconds = secondsSince(start);
+		JsonLine("index_build").add("k", k).add("max_ns", opts.maxIndexedNs).add("max_occurrences", opts.maxSeedOccurrences).add("genomes", genomes.size()).add("bases", totalBases)
+			.add("seconds", seconds).add("allocations", g_allocations.load(memory_order_relaxed) - allocationsBefore)
+			.add("rss_delta_kb", currentRssKb() - rssBefore).add("peak_heap_kb", (g_peakHeapBytes.load(memory_order_relaxed) - heapBefore) / 1024).print();
+		if (opts.freeze) {
+			long long rssBeforeFreeze = currentRssKb();
+			long long heapBeforeFreeze = g_heapBytes.load(memory_order_relaxed);
+			resetPeakHeap();
+			allocationsBefore = g_allocations.load(memory_order_relaxed);
+			start = Clock::now();
+			library->freezeIndex();
+			JsonLine("index_freeze").add("k", k).add("seconds", secondsSince(start))
+				.add("allocations", g_allocations.load(memory_order_relaxed) - allocationsBefore)
+				.add("rss_delta_kb", currentRssKb() - rssBeforeFreeze)
+				.add("peak_heap_kb", (g_peakHeapBytes.load(memory_order_relaxed) - heapBeforeFreeze) / 1024).print();
+		}
+
+		benchQueries(opts, *library, genomes, k);
+		benchCache(opts, *library, genomes, k);
+		benchRelated(opts, *library, files, k);
+		delete library;
+	}
+}
@@ -4,25 +4,129 @@
 #include <iostream>
 #include <istream>
 #include <cctype>
+#include <cstring>
+#include <thread>
+#include <algorithm>
+#include <memory>
+#include <iterator>
+#include <mutex>
+#include <unordered_set>
+#if defined(__SSE2__) || defined(_M_X64) || defined(_M_IX86_FP) && _M_IX86_FP >= 2
+#include <emmintrin.h>
+#define GENOME_USE_SSE2
+#endif
+#if defined(_WIN32)
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
 using namespace std;
 
 class GenomeImpl
 {
 public:
 	GenomeImpl(const string& nm, const string& sequence);
+	GenomeImpl(const string& nm, string&& sequence);
 	static bool load(istream& genomeSource, vector<Genome>& genomes);
+	static bool loadFile(const string& filename, vector<Genome>& genomes);
+	static bool normalizeSequence(string& sequence);
 	int length() const;
-	string name() const;
+	const string& name() const;
 	bool extract(int position, int length, string& fragment) const;
+	const string& sequence() const;
 private:
-	string m_name;
-	string m_sequence;
+	const string *m_name;	// points into the name table, which never frees or moves a name
+	shared_ptr<const string> m_sequence;	// shared by every copy of this genome, never modified
+
+		// called by the constructors
+	static const string* internName(const string &name);
 
 		// called by load
 	static bool isValidName(string &name);
 	static bool isValidSequence(string &sequence);
 	static bool isValidBase(char &base);
+	static bool foldBases(char *bases, size_t length);
 	static void addGenome(vector<Genome> &genomes, string &name, string &sequence);
+	struct BaseTable;
+	static const BaseTable s_baseTable;
+
+		// called by loadFile
+	class MappedFile;
+	struct Record;
+	struct ParseResult;
+	static void findRecords(const char *data, size_t size, vector<Record> &records);
+	static void parseRecords(const char *data, const vector<Record> &records, size_t first, size_t last, ParseResult &result);
+	static bool parseRecord(const char *data, const Record &record, string &name, string &sequence, bool &badName);
+};
+
+//=================================================================================================
+//	struct BaseTable
+//	maps each of the 256 chars to its uppercase base if it is an upper or lowercase 'A', 'C', 'T',
+//	'G', or 'N', and to 0 otherwise
+//=================================================================================================
+struct GenomeImpl::BaseTable {
+	char upper[256];
+
+	BaseTable() {
+		memset(upper, 0, sizeof(upper));
+		const char bases[] = "ACGTN";
+		for (int i = 0; bases[i] != '\0'; i++) {
+			upper[(unsigned char)bases[i]] = bases[i];
+			upper[(unsigned char)tolower(bases[i])] = bases[i];
+		}
+	}
+};
+
+const GenomeImpl::BaseTable GenomeImpl::s_baseTable;
+
+//=================================================================================================
+//	class MappedFile
+//	maps a whole file read-only into memory for as long as the object lives
+//=================================================================================================
+class GenomeImpl::MappedFile
+{
+public:
+	MappedFile(const string &filename);
+	~MappedFile();
+	bool isOpen() const { return m_open; }
+	const char* data() const { return m_data; }
+	size_t size() const { return m_size; }
+
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+private:
+	bool m_open;
+	const char *m_data;
+	size_t m_size;
+#if defined(_WIN32)
+	HANDLE m_file;
+	HANDLE m_mapping;
+#endif
+};
+
+//=================================================================================================
+//	struct Record
+//	the byte range [begin, end) of one genome in a mapped file: its name line and all of its
+//	sequence lines
+//=================================================================================================
+struct GenomeImpl::Record {
+	size_t begin;
+	size_t end;
+};
+
+//=================================================================================================
+//	struct ParseResult
+//	what one thread of loadFile produced: the genomes of its records, the index of its first bad
+//	record (or one past its last record), and whether that record's name line was the problem
+//=================================================================================================
+struct GenomeImpl::ParseResult {
+	vector<Genome> genomes;
+	size_t badRecord;
+	bool badName;
 };
 
 //=================================================================================================
@@ -34,7 +138,14 @@ private:
 //	initializes m_name and m_sequence to the specified values
 //=================================================================================================
 GenomeImpl::GenomeImpl(const string& nm, const string& sequence)
-	: m_name(nm), m_sequence(sequence) {}
+	: m_name(internName(nm)), m_sequence(make_shared<const string>(sequence)) {}
+
+//=================================================================================================
+//	constructor
+//	same as above, but takes over sequence's storage instead of copying it
+//=================================================================================================
+GenomeImpl::GenomeImpl(const string& nm, string&& sequence)
+	: m_name(internName(nm)), m_sequence(make_shared<const string>(move(sequence))) {}
 
 //=================================================================================================
 //	bool load
@@ -69,22 +180,83 @@ bool GenomeImpl::load(istream& genomeSource, vector<Genome>& genomes)
 	return true;
 }
 
+//=================================================================================================
+//	bool loadFile
+//	does the same as load on the file named filename, but maps the file into memory and splits it
+//	into records at each line starting with '>', which are then validated and copied out in
+//	parallel. Like load, returns false if the file can't be read or is formatted incorrectly, in
+//	which case genomes still gets every genome that comes before the first bad one
+//=================================================================================================
+bool GenomeImpl::loadFile(const string& filename, vector<Genome>& genomes)
+{
+	MappedFile file(filename);
+	if (!file.isOpen() || file.size() == 0)
+		return false;
+
+	vector<Record> records;
+	findRecords(file.data(), file.size(), records);
+
+	// give each thread a contiguous run of records holding about the same number of bytes
+	size_t numThreads = max(1u, thread::hardware_concurrency());
+	numThreads = min(numThreads, max((size_t)1, file.size() / (1 << 20)));	// at least 1MB each
+	numThreads = min(numThreads, records.size());
+	vector<size_t> bounds(1, 0);	// thread t parses records [bounds[t], bounds[t + 1])
+	for (size_t i = 0; i < records.size() && bounds.size() < numThreads; i++) {
+		if (records[i].end >= file.size() * bounds.size() / numThreads)
+			bounds.push_back(i + 1);
+	}
+	bounds.push_back(records.size());
+
+	vector<ParseResult> parsed(bounds.size() - 1);
+	vector<thread> workers;
+	for (size_t t = 1; t < parsed.size(); t++)
+		workers.push_back(thread(parseRecords, file.data(), cref(records), bounds[t], bounds[t + 1], ref(parsed[t])));
+	parseRecords(file.data(), records, bounds[0], bounds[1], parsed[0]);
+	for (size_t t = 0; t < workers.size(); t++)
+		workers[t].join();
+
+	// keep everything load would have added before reaching the first bad record
+	for (size_t t = 0; t < parsed.size(); t++) {
+		genomes.insert(genomes.end(), make_move_iterator(parsed[t].genomes.begin()), make_move_iterator(parsed[t].genomes.end()));
+		if (parsed[t].badRecord != bounds[t + 1]) {
+			if (parsed[t].badName && parsed[t].badRecord > 0)	// load only adds a genome once it
+				genomes.pop_back();								// reads the next valid name
+			return false;
+		}
+	}
+	return true;
+}
+
+//=================================================================================================
+//	bool normalizeSequence
+//	returns true if every character of sequence is an upper or lowercase 'A', 'C', 'T', 'G', or
+//	'N' and changes them all to uppercase. Otherwise, returns false and leaves sequence unchanged
+//=================================================================================================
+bool GenomeImpl::normalizeSequence(string& sequence)
+{
+	string temp = sequence;
+	if (!temp.empty() && !foldBases(&temp[0], temp.size()))
+		return false;
+	sequence.swap(temp);
+	return true;
+}
+
 //=================================================================================================
 //	int length
 //	returns the length of m_sequence
 //=================================================================================================
 int GenomeImpl::length() const
 {
-	return m_sequence.size();
+	return m_sequence->size();
 }
 
 //=================================================================================================
-//	string name
-//	returns m_name
+//	const string& name
+//	returns the interned name that m_name points to
 //=================================================================================================
-string GenomeImpl::name() const
+const string& GenomeImpl::name() const
 {
-	return m_name;
+	return *m_name;
 }
 
 //=================================================================================================
@@ -94,24 +266,46 @@ string GenomeImpl::name() const
 //=================================================================================================
 bool GenomeImpl::extract(int position, int length, string& fragment) const
 {
-	if (m_sequence.empty())
+	if (m_sequence->empty())
 		return false;
-	string temp = "";
-
-	for (int i = position; i < position + length; i++) {
-		if (i < 0 || i >= m_sequence.size())
-			return false;
-		temp += m_sequence[i];
+	if (length <= 0) {	// nothing to check or copy
+		fragment = "";
+		return true;
 	}
+	if (position < 0 || (long long)position + length > (long long)m_sequence->size())
+		return false;
 
-	fragment = temp;
+	fragment.assign(*m_sequence, position, length);
 	return true;
 }
 
+//=================================================================================================
+//	const string& sequence
+//	returns m_sequence itself, which is shared by every copy of this genome and never modified
+//=================================================================================================
+const string& GenomeImpl::sequence() const
+{
+	return *m_sequence;
+}
+
 //=================================================================================================
 //	PRIVATE MEMBERS
 //=================================================================================================
 
+//=================================================================================================
+//	const string* internName
+//	returns the name table's copy of name, adding it if this is the first genome with that name.
+//	The table lives as long as the program, so the returned string stays valid after every genome
+//	with that name is gone, and genomes with equal names get the same pointer. Safe to call from
+//	several threads at once (loadFile does)
+//=================================================================================================
+const string* GenomeImpl::internName(const string &name) {
+	static mutex tableMutex;
+	static unordered_set<string> *table = new unordered_set<string>;	// never destroyed, so names outlive static genomes
+	lock_guard<mutex> lock(tableMutex);
+	return &*table->insert(name).first;
+}
+
 //=================================================================================================
 //	bool isValidName
 //	returns true if name is a correctly formatted genome name and removes the '>' from the
@@ -127,19 +321,12 @@ bool GenomeImpl::isValidName(string &name) {
 //=================================================================================================
 //	bool isValidSequence
 //	returns true if sequence is a correctly formatted genome sequence and changes all characters to
-//	uppercase. Otherwise, returns false and leaves sequence unchanged
+//	uppercase. Otherwise, returns false and sequence may be left partly uppercased
 //=================================================================================================
 bool GenomeImpl::isValidSequence(string &sequence) {
 	if (sequence.empty() || sequence.size() > 80)
 		return false;
-	string temp = sequence;
-	for (size_t i = 0; i < temp.size(); i++) {
-		if (!isValidBase(temp[i]))
-			return false;
-	}
-
-	sequence = temp;
-	return true;
+	return foldBases(&sequence[0], sequence.size());
 }
 
 //=================================================================================================
@@ -148,9 +335,42 @@ bool GenomeImpl::isValidSequence(string &sequence) {
 //	be uppercase. Otherwise, returns false and leaves base unchanged
 //=================================================================================================
 bool GenomeImpl::isValidBase(char &base) {
-	if (base == 'a' || base == 'c' || base == 't' || base == 'g' || base == 'n')
-		base = toupper(base);
-	return base == 'A' || base == 'C' || base == 'T' || base == 'G' || base == 'N';
+	char upper = s_baseTable.upper[(unsigned char)base];
+	if (upper == 0)
+		return false;
+	base = upper;
+	return true;
+}
+
+//=================================================================================================
+//	bool foldBases
+//	does isValidBase on each of the length chars starting at bases, returning false as soon as one
+//	is invalid (possibly after uppercasing some of the others). With SSE2, sixteen chars are done
+//	at a time: setting bit 0x20 lowercases any letter, and a char is a valid base exactly when its
+//	lowercase is one of "acgtn", in which case clearing bit 0x20 gives its uppercase
+//=================================================================================================
+bool GenomeImpl::foldBases(char *bases, size_t length) {
+	size_t i = 0;
+#if defined(GENOME_USE_SSE2)
+	const __m128i caseBit = _mm_set1_epi8(0x20);
+	const __m128i a = _mm_set1_epi8('a'), c = _mm_set1_epi8('c'), g = _mm_set1_epi8('g');
+	const __m128i t = _mm_set1_epi8('t'), n = _mm_set1_epi8('n');
+
+	for (; i + 16 <= length; i += 16) {
+		__m128i chunk = _mm_loadu_si128((const __m128i *)(bases + i));
+		__m128i lower = _mm_or_si128(chunk, caseBit);
+		__m128i valid = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(lower, a), _mm_cmpeq_epi8(lower, c)),
+			_mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(lower, g), _mm_cmpeq_epi8(lower, t)), _mm_cmpeq_epi8(lower, n)));
+		if (_mm_movemask_epi8(valid) != 0xFFFF)
+			return false;
+		_mm_storeu_si128((__m128i *)(bases + i), _mm_andnot_si128(caseBit, chunk));
+	}
+#endif
+	for (; i < length; i++) {	// whatever is left (or everything, without SSE2)
+		if (!isValidBase(bases[i]))
+			return false;
+	}
+	return true;
 }
 
 //=================================================================================================
@@ -159,11 +379,149 @@ bool GenomeImpl::isValidBase(char &base) {
 //	sequence to empty strings
 //=================================================================================================
 void GenomeImpl::addGenome(vector<Genome> &genomes, string &name, string &sequence) {
-	genomes.push_back(Genome(name, sequence));
+	genomes.push_back(Genome(name, move(sequence)));
 	name = "";
 	sequence = "";
 }
 
+//=================================================================================================
+//	void findRecords
+//	sets records to the byte ranges of data that each start at a line beginning with '>' (or at
+//	the start of data) and run to the next one
+//=================================================================================================
+void GenomeImpl::findRecords(const char *data, size_t size, vector<Record> &records) {
+	records.clear();
+	size_t begin = 0;
+	const char *cur = data;
+	const char *end = data + size;
+
+	while ((cur = (const char *)memchr(cur, '\n', end - cur)) != nullptr) {
+		cur++;	// start of the next line
+		if (cur < end && *cur == '>') {
+			records.push_back(Record{ begin, (size_t)(cur - data) });
+			begin = cur - data;
+		}
+	}
+	records.push_back(Record{ begin, size });
+}
+
+//=================================================================================================
+//	void parseRecords
+//	adds a genome to result for each of records[first] to records[last - 1], stopping at the first
+//	one that is formatted incorrectly
+//=================================================================================================
+void GenomeImpl::parseRecords(const char *data, const vector<Record> &records, size_t first, size_t last, ParseResult &result) {
+	result.genomes.reserve(last - first);
+	result.badName = false;
+	for (result.badRecord = first; result.badRecord < last; result.badRecord++) {
+		string name, sequence;
+		if (!parseRecord(data, records[result.badRecord], name, sequence, result.badName))
+			return;
+		result.genomes.push_back(Genome(name, move(sequence)));
+	}
+}
+
+//=================================================================================================
+//	bool parseRecord
+//	sets name and sequence from the record if it is one name line followed by at least one valid
+//	sequence line and returns true. Otherwise, returns false and sets badName to whether the name
+//	line was the problem. Lines follow the same rules as in load
+//=================================================================================================
+bool GenomeImpl::parseRecord(const char *data, const Record &record, string &name, string &sequence, bool &badName) {
+	const char *cur = data + record.begin;
+	const char *end = data + record.end;
+	if (end[-1] == '\n')	// the last line's newline ends the line rather than starting a new one
+		end--;
+
+	const char *lineEnd = (const char *)memchr(cur, '\n', end - cur);
+	if (lineEnd == nullptr)
+		lineEnd = end;
+	badName = lineEnd - cur <= 1 || *cur != '>';
+	if (badName)	// first line should be a name
+		return false;
+	name.assign(cur + 1, lineEnd);
+
+	sequence.reserve(end - lineEnd);	// at least as big as the sequence will be
+	while (lineEnd < end) {
+		cur = lineEnd + 1;
+		lineEnd = (const char *)memchr(cur, '\n', end - cur);
+		if (lineEnd == nullptr)
+			lineEnd = end;
+		size_t length = lineEnd - cur;
+		if (length == 0 || length > 80)
+			return false;
+		size_t start = sequence.size();
+		sequence.append(cur, length);
+		if (!foldBases(&sequence[start], length))
+			return false;
+	}
+	return !sequence.empty();
+}
+
+//=================================================================================================
+//	MappedFile constructor
+//	maps the file named filename. isOpen returns false if that fails
+//=================================================================================================
+GenomeImpl::MappedFile::MappedFile(const string &filename)
+	: m_open(false), m_data(nullptr), m_size(0)
+{
+#if defined(_WIN32)
+	m_mapping = NULL;
+	m_file = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+	if (m_file == INVALID_HANDLE_VALUE)
+		return;
+	LARGE_INTEGER size;
+	if (!GetFileSizeEx(m_file, &size))
+		return;
+	m_size = (size_t)size.QuadPart;
+	m_open = true;
+	if (m_size == 0)	// empty files can't be mapped
+		return;
+	m_mapping = CreateFileMappingA(m_file, NULL, PAGE_READONLY, 0, 0, NULL);
+	if (m_mapping != NULL)
+		m_data = (const char *)MapViewOfFile(m_mapping, FILE_MAP_READ, 0, 0, 0);
+	m_open = m_data != nullptr;
+#else
+	int fd = open(filename.c_str(), O_RDONLY);
+	if (fd < 0)
+		return;
+	struct stat info;
+	if (fstat(fd, &info) == 0) {
+		m_size = info.st_size;
+		m_open = true;
+		if (m_size > 0) {	// empty files can't be mapped
+			void *mapped = mmap(nullptr, m_size, PROT_READ, MAP_PRIVATE, fd, 0);
+			if (mapped == MAP_FAILED)
+				m_open = false;
+			else {
+				m_data = (const char *)mapped;
+				madvise(mapped, m_size, MADV_SEQUENTIAL);
+			}
+		}
+	}
+	close(fd);	// the mapping stays valid after the descriptor is closed
+#endif
+}
+
+//=================================================================================================
+//	MappedFile destructor
+//	unmaps the file
+//=================================================================================================
+GenomeImpl::MappedFile::~MappedFile()
+{
+#if defined(_WIN32)
+	if (m_data != nullptr)
+		UnmapViewOfFile(m_data);
+	if (m_mapping != NULL)
+		CloseHandle(m_mapping);
+	if (m_file != INVALID_HANDLE_VALUE)
+		CloseHandle(m_file);
+#else
+	if (m_data != nullptr)
+		munmap((void *)m_data, m_size);
+#endif
+}
+
 //******************** Genome functions ************************************
 
 // These functions simply delegate to GenomeImpl's functions.
@@ -174,6 +532,11 @@ Genome::Genome(const string& nm, const string& sequence)
 	m_impl = new GenomeImpl(nm, sequence);
 }
 
+Genome::Genome(const string& nm, string&& sequence)
+{
+	m_impl = new GenomeImpl(nm, move(sequence));
+}
+
 Genome::~Genome()
 {
 	delete m_impl;
@@ -192,17 +555,39 @@ Genome& Genome::operator=(const Genome& rhs)
 	return *this;
 }
 
+Genome::Genome(Genome&& other) noexcept
+{
+	m_impl = other.m_impl;
+	other.m_impl = nullptr;
+}
+
+Genome& Genome::operator=(Genome&& rhs) noexcept
+{
+	swap(m_impl, rhs.m_impl);
+	return *this;
+}
+
 bool Genome::load(istream& genomeSource, vector<Genome>& genomes)
 {
 	return GenomeImpl::load(genomeSource, genomes);
 }
 
+bool Genome::loadFile(const string& filename, vector<Genome>& genomes)
+{
+	return GenomeImpl::loadFile(filename, genomes);
+}
+
+bool Genome::normalizeSequence(string& sequence)
+{
+	return GenomeImpl::normalizeSequence(sequence);
+}
+
 int Genome::length() const
 {
 	return m_impl->length();
 }
 
-string Genome::name() const
+const string& Genome::name() const
 {
 	return m_impl->name();
 }
@@ -211,3 +596,8 @@ bool Genome::extract(int position, int length, string& fragment) const
 {
 	return m_impl->extract(position, length, fragment);
 }
+
+const string& Genome::sequence() const
+{
+	return m_impl->sequence();
+}
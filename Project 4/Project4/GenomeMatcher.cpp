@@ -5,29 +5,211 @@
 #include <vector>
 #include <iostream>
 #include <fstream>
+#include <cstdint>
+#include <cstring>
+#include <unordered_map>
+#include <map>
+#include <list>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <thread>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define GENOMEMATCHER_USE_AVX2
+#endif
+#if defined(__SSE2__) || defined(_M_X64) || defined(_M_IX86_FP) && _M_IX86_FP >= 2
+#include <emmintrin.h>
+#define GENOMEMATCHER_USE_SSE2
+#endif
 using namespace std;
 
+//=================================================================================================
+//	class ResultCache
+//	remembers the results of the most recently used findGenomesWithThisDNA queries, up to a set
+//	capacity, and counts the lookups that found a result (hits) and that did not (misses). The
+//	results are split by key hash among up to MAX_SHARDS shards, each with its own lock, its own
+//	share of the capacity and its own least recently used order, so concurrent queries only wait
+//	for each other when their keys land in the same shard. While the cache is off, find and store
+//	return before taking any lock
+//=================================================================================================
+class ResultCache
+{
+public:
+	ResultCache();
+	void setCapacity(size_t capacity);
+	void clear();
+	bool enabled() const { return m_numShards.load(memory_order_relaxed) > 0; }
+	bool find(const string &fragment, int minimumLength, bool exactMatchOnly, bool bothStrands, vector<DNAMatch> &matches, bool &found);
+	void store(const string &fragment, int minimumLength, bool exactMatchOnly, bool bothStrands, const vector<DNAMatch> &matches, bool found);
+	long long hits() const;
+	long long misses() const;
+private:
+	struct Key {
+		string fragment;
+		int minimumLength;
+		bool exactMatchOnly;
+		bool bothStrands;
+		bool operator==(const Key &other) const {
+			return minimumLength == other.minimumLength && exactMatchOnly == other.exactMatchOnly && bothStrands == other.bothStrands
+				&& fragment == other.fragment;
+		}
+	};
+	struct KeyHash {
+		size_t operator()(const Key &key) const {
+			return hash<string>()(key.fragment) ^ ((size_t)key.minimumLength << 2 | key.bothStrands << 1 | key.exactMatchOnly) * 0x9E3779B97F4A7C15ULL;
+		}
+	};
+	struct Entry {
+		Key key;
+		vector<DNAMatch> matches;
+		bool found;
+	};
+	struct Shard {
+		mutex lock;	// held while the shard's results are looked up or changed
+		size_t capacity;
+		list<Entry> entries;	// most recently used first
+		unordered_map<Key, list<Entry>::iterator, KeyHash> index;	// where each key's entry is in entries
+		atomic<long long> hits;
+		atomic<long long> misses;
+		char padding[64];	// keeps the counts off the cache line of the next shard's lock
+	};
+	static const size_t MAX_SHARDS = 16;
+	Shard m_shards[MAX_SHARDS];
+	atomic<size_t> m_numShards;	// shards in use, 0 if the cache is off
+
+	Shard& shardFor(const Key &key) { return m_shards[KeyHash()(key) % m_numShards.load(memory_order_relaxed)]; }
+};
+
+//=================================================================================================
+//	class KmerFilter
+//	a blocked Bloom filter of the k-mers of one genome. Each k-mer's hash sets one bit in each of
+//	the BLOCK_WORDS words of the block its top bits pick, so a lookup reads one 64 byte block. It
+//	never says a k-mer of the genome is missing, and says some other k-mer is there about one time
+//	in a hundred. An empty filter says every k-mer is there
+//=================================================================================================
+class KmerFilter
+{
+public:
+	KmerFilter();
+	KmerFilter(const vector<uint64_t> &hashes);
+	bool empty() const;
+	bool mayContain(uint64_t hash) const;
+private:
+	static const int BITS_PER_KMER = 10;
+	static const int BLOCK_WORDS = 8;
+	vector<uint64_t> m_words;	// the blocks, BLOCK_WORDS words each
+	uint64_t m_numBlocks;	// 0 if the filter is empty
+
+	size_t blockStart(uint64_t hash) const;
+	static uint64_t bitInWord(uint64_t hash, int word);
+};
+
 class GenomeMatcherImpl
 {
 public:
-	GenomeMatcherImpl(int minSearchLength);
+	GenomeMatcherImpl(int minSearchLength, int sketchScale);
+	GenomeMatcherImpl* createEmptyCopy() const;
 	void addGenome(const Genome& genome);
+	void addGenomesFrom(GenomeMatcherImpl& other);
+	void addCopiesFrom(GenomeMatcherImpl& other);
+	const vector<Genome>& genomes() const;
+	void clear();
 	int minimumSearchLength() const;
-	bool findGenomesWithThisDNA(const string& fragment, int minimumLength, bool exactMatchOnly, vector<DNAMatch>& matches) const;
-	bool findRelatedGenomes(const Genome& query, int fragmentMatchLength, bool exactMatchOnly, double matchPercentThreshold, vector<GenomeMatch>& results) const;
+	bool findGenomesWithThisDNA(const string& fragment, int minimumLength, bool exactMatchOnly, vector<DNAMatch>& matches, bool bothStrands) const;
+	bool findGenomesWithMismatches(const string& fragment, int minimumLength, int maxMismatches, vector<DNAMatch>& matches) const;
+	bool findGenomesWithMismatchesBatch(const vector<string>& fragments, int minimumLength, int maxMismatches, vector<vector<DNAMatch>>& matches) const;
+	bool findRelatedGenomes(const Genome& query, int fragmentMatchLength, bool exactMatchOnly, double matchPercentThreshold, vector<GenomeMatch>& results, bool bothStrands) const;
+	bool findRelatedGenomesSketch(const Genome& query, int fragmentMatchLength, bool exactMatchOnly, double matchPercentThreshold, int verifyTop, vector<GenomeMatch>& results) const;
+	bool findRelatedPercentages(const Genome& query, int fragmentMatchLength, bool exactMatchOnly, vector<double>& percents, bool bothStrands) const;
+	void setResultCacheCapacity(int capacity);
+	long long resultCacheHits() const;
+	long long resultCacheMisses() const;
+	void setMaxIndexedNs(int maxNs);
+	void setMaxSeedOccurrences(int maxOccurrences);
+	void setFragmentStride(int stride);
+	void setRelatedPrefilter(int sampleFragments);
+	void freezeIndex();
 private:
 	struct SeqFrag;
+	struct Hit;
+	struct KmerCache;
+	class FrozenIndex;
+	static const int SKETCH_KMER_LENGTH = 21;	// length of the k-mers hashed into sketches
+	static const int MAX_PLANNED_RUNS = 8;	// most runs of seed k-mers planSeeds compares
+	static const int MIN_PLANNED_SEEDS = 64;	// fewer seeds than this are cheaper to extend than to plan
 	int m_minSearchLength;
+	int m_sketchScale;	// keep one k-mer hash in about this many, 0 if sketching is off
+	int m_maxIndexedNs;	// windows with more Ns than this are not indexed, -1 to index every window
+	int m_strictestMaxNs;	// smallest m_maxIndexedNs any genome was indexed with, -1 if none had one
+	int m_maxSeedOccurrences;	// k-mers found more often than this are masked, 0 to mask none
+	int m_fragmentStride;	// findRelatedGenomes starts a fragment every this many bases, 0 for back to back fragments
+	int m_prefilterSample;	// most fragments findRelatedGenomes tests against the k-mer filters, 0 if prefiltering is off
 	vector<Genome> m_genomeList;
-	Trie<SeqFrag> m_seqFragTrie;
+	vector<int> m_genomeMaxNs;	// the m_maxIndexedNs each genome in m_genomeList was indexed with
+	vector<vector<uint64_t>> m_sketches;	// sorted sketch of each genome in m_genomeList
+	vector<KmerFilter> m_kmerFilters;	// k-mer filter of each genome in m_genomeList, empty if prefiltering was off
+	Trie<SeqFrag, DnaAlphabet> m_seqFragTrie;	// empty while the index is frozen
+	unique_ptr<FrozenIndex> m_frozenIndex;	// holds the posting lists instead of m_seqFragTrie once frozen, nullptr until then
+	unordered_map<string, int> m_maskedKmers;	// masked k-mers and how often each was found, not in m_seqFragTrie
+	mutable ResultCache m_resultCache;	// emptied by addGenome
+
+		// called by the search functions, read from whichever of m_seqFragTrie and m_frozenIndex is in use
+	vector<SeqFrag> findSeeds(const string &kmer, int maxMismatches) const;
+	void findSeedsBatch(const vector<string> &kmers, int maxMismatches, vector<vector<SeqFrag>> &seeds) const;
+	size_t countSeeds(const string &kmer, int maxMismatches) const;
 
-		// called by findGenomesWithThisDNA
-	DNAMatch findMatch(const string &fragment, const SeqFrag &match, bool exactMatchOnly) const;
-	bool sameGenome(const DNAMatch &newMatch, const vector<DNAMatch> &existingMatches, int &genomeInd) const;
+		// called by findGenomesWithMismatches and findGenomesWithMismatchesBatch
+	bool searchFragment(const string &fragment, int minimumLength, int maxMismatches, const vector<bool> *allowed, KmerCache *cache, vector<Hit> &hits) const;
+	bool searchBatch(const vector<string> &fragments, int minimumLength, int maxMismatches, const vector<bool> *allowed, vector<vector<Hit>> &hits) const;
+	bool isMasked(const string &kmer) const;
+	bool isIndexed(const string &kmer) const;
+	bool isIndexedIn(const string &kmer, int genomeIndex) const;
+	bool planSeeds(const string &fragment, int minimumLength, int maxMismatches, KmerCache *cache, vector<int> &offsets) const;
+	void seedFromPlan(const string &fragment, const vector<int> &offsets, KmerCache *cache, vector<SeqFrag> &candidates) const;
+	size_t exactCost(const string &fragment, int offset, KmerCache *cache) const;
+	const vector<SeqFrag>& exactPlaces(const string &fragment, int offset, KmerCache *cache, vector<SeqFrag> &uncached) const;
+	bool collectMatches(const string &fragment, int minimumLength, int maxMismatches, const vector<SeqFrag> &candidates, const vector<bool> *allowed, vector<Hit> &hits) const;
+	Hit findMatch(const string &fragment, const SeqFrag &match, int maxMismatches) const;
+	static int matchLength(const char *a, const char *b, int n, int maxMismatches);
+	static uint64_t differingChars(const char *a, const char *b, int count);
+	static int spendMismatches(uint64_t differing, int &maxMismatches);
+	static int countTrailingZeros(uint64_t bits);
+	static int countBits(uint64_t bits);
+	bool sameGenome(const Hit &newMatch, const vector<Hit> &existingMatches, int &genomeInd) const;
+	static bool isBetter(const Hit &a, const Hit &b);
+	static void addMatches(const vector<Hit> &hits, vector<DNAMatch> &matches);
 
-		// called by findRelatedGenomes
-	int numMatches(const vector<DNAMatch> &allMatches, const string &genomeName) const;
+		// called by findGenomesWithThisDNA and relatedAmong when searching both strands
+	bool searchBothStrands(const string &fragment, int minimumLength, int maxMismatches, vector<DNAMatch> &matches) const;
+	void mergeStrands(const vector<Hit> &reverse, vector<Hit> &hits) const;
+	static void reverseComplement(const string &dna, string &complement);
+
+		// called by findRelatedGenomes and findRelatedGenomesSketch
+	bool relatedAmong(const Genome &query, int fragmentMatchLength, int maxMismatches, double matchPercentThreshold, const vector<bool> *allowed, bool bothStrands, vector<GenomeMatch> &results) const;
 	void insertMatch(const GenomeMatch &match, vector<GenomeMatch> &allMatches) const;
+
+		// called by relatedAmong and findRelatedPercentages
+	int countMatches(const Genome &query, int fragmentMatchLength, int maxMismatches, const vector<bool> *allowed, bool bothStrands, unordered_map<const string*, int> &numMatches) const;
+	int countFragmentMatches(const Genome &query, int fragmentMatchLength, int maxMismatches, const vector<bool> *allowed, bool bothStrands, unordered_map<const string*, int> &numMatches) const;
+	int countWindowMatches(const Genome &query, int fragmentMatchLength, int maxMismatches, const vector<bool> *allowed, bool bothStrands, unordered_map<const string*, int> &numMatches) const;
+
+		// called by addGenome, addGenomesFrom and addCopiesFrom
+	KmerFilter buildFilter(const string &sequence) const;
+	bool sameIndexing(const GenomeMatcherImpl &other) const;
+
+		// called by findRelatedGenomes when prefiltering is on
+	bool prefilter(const Genome &query, int fragmentMatchLength, int maxMismatches, double matchPercentThreshold, bool bothStrands, vector<bool> &allowed) const;
+	bool mayMatch(const KmerFilter &filter, const uint64_t *hashes, int count, int maxMismatches) const;
+
+		// called by addGenome, findRelatedGenomesSketch and prefilter
+	static void buildSketch(const string &sequence, int scale, vector<uint64_t> &sketch);
+	static uint64_t hashKmer(uint64_t code);
+	static void hashKmers(const string &dna, int kmerLength, vector<uint64_t> &hashes);
+	static int sharedHashes(const vector<uint64_t> &a, const vector<uint64_t> &b);
 };
 
 //=================================================================================================
@@ -40,33 +222,257 @@ struct GenomeMatcherImpl::SeqFrag {
 	int position;
 };
 
+//=================================================================================================
+//	struct Hit
+//	a DNAMatch that has not been reported yet. It points at the genome's interned name instead of
+//	copying it, so two hits are from genomes with the same name exactly when the pointers are equal
+//=================================================================================================
+struct GenomeMatcherImpl::Hit {
+	const string *genomeName;
+	int genomeIndex;
+	int length;
+	int position;
+	bool reverseStrand;	// true if the fragment's reverse complement matched
+};
+
+//=================================================================================================
+//	struct KmerCache
+//	the exact lookups of the k-mers of one query sequence, kept by where each k-mer starts in it,
+//	so that the overlapping windows of countWindowMatches look each one up only once. moveTo
+//	drops the k-mers outside the next window, as the windows only ever move one way
+//=================================================================================================
+struct GenomeMatcherImpl::KmerCache {
+	int start;	// where the window being searched starts in the sequence
+	map<int, size_t> costs;	// what exactCost returned for the k-mer at each place
+	map<int, vector<SeqFrag>> places;	// what findSeeds found for the k-mer at each place, exactly
+
+	void moveTo(int windowStart, int windowLength);
+};
+
+//=================================================================================================
+//	class FrozenIndex
+//	a read-only, compressed copy of m_seqFragTrie's posting lists. Every list is already sorted by
+//	genome and position, so each place is stored as its difference from the place before it. The
+//	differences are bit-packed in blocks of BLOCK_SIZE, each block only as wide as its largest
+//	difference needs, and unpacked without branches before being summed back into places. m_lists
+//	maps each k-mer to where its list starts in m_bytes, so lookups with mismatches walk the same
+//	tree the live index does, frozen into breadth-first arrays
+//=================================================================================================
+class GenomeMatcherImpl::FrozenIndex
+{
+public:
+	FrozenIndex(Trie<SeqFrag, DnaAlphabet> &trie);
+	vector<SeqFrag> find(const string &kmer, int maxMismatches) const;
+	void findBatch(const vector<string> &kmers, int maxMismatches, vector<vector<SeqFrag>> &seeds) const;
+	size_t count(const string &kmer, int maxMismatches) const;
+	void thaw(Trie<SeqFrag, DnaAlphabet> &trie);
+private:
+	struct List {
+		size_t start;	// where the list's blocks start in m_bytes
+		size_t size;	// number of places in the list
+	};
+	static const int BLOCK_SIZE = 128;	// places per bit-packed block
+	Trie<List, DnaAlphabet> m_lists;	// each k-mer's list
+	vector<unsigned char> m_bytes;	// the blocks of every list, then 8 bytes of padding
+
+	void encode(const vector<SeqFrag> &list);
+	void decode(const List &packed, vector<SeqFrag> &list) const;
+	void pack(const uint32_t *values, int count);
+	static const unsigned char* unpack(const unsigned char *p, int count, uint32_t *values);
+};
+
+// defined here too since planSeeds passes it to min, which takes it by reference
+const int GenomeMatcherImpl::MAX_PLANNED_RUNS;
+
 //=================================================================================================
 //	PUBLIC MEMBERS
 //=================================================================================================
 
 //=================================================================================================
 //	constructor
-//	sets m_minSearchLength to minSearchLength
+//	sets m_minSearchLength to minSearchLength and m_sketchScale to sketchScale
+//=================================================================================================
+GenomeMatcherImpl::GenomeMatcherImpl(int minSearchLength, int sketchScale)
+	: m_minSearchLength(minSearchLength), m_sketchScale(max(sketchScale, 0)), m_maxIndexedNs(-1), m_strictestMaxNs(-1), m_maxSeedOccurrences(0), m_fragmentStride(0), m_prefilterSample(0) {}
+
+//=================================================================================================
+//	GenomeMatcherImpl* createEmptyCopy
+//	returns a new library with no genomes and the options that decide how genomes are indexed,
+//	sketched and filtered, so that addGenomesFrom can take over what it builds
 //=================================================================================================
-GenomeMatcherImpl::GenomeMatcherImpl(int minSearchLength)
-	: m_minSearchLength(minSearchLength) {}
+GenomeMatcherImpl* GenomeMatcherImpl::createEmptyCopy() const
+{
+	GenomeMatcherImpl *copy = new GenomeMatcherImpl(m_minSearchLength, m_sketchScale);
+	copy->m_maxIndexedNs = m_maxIndexedNs;
+	copy->m_maxSeedOccurrences = m_maxSeedOccurrences;
+	copy->m_prefilterSample = m_prefilterSample;
+	return copy;
+}
 
 //=================================================================================================
 //	void addGenome
 //	adds genome to m_genomeList and each substring of its DNA sequence of length m_minSearchLength
-//	to m_seqFragTrie
+//	to m_seqFragTrie, except those with more than m_maxIndexedNs Ns if that is not -1 and those
+//	with a char other than A, C, G, T or N, which the trie leaves out. A k-mer that ends up in
+//	more than m_maxSeedOccurrences places (if that is not 0) is moved from m_seqFragTrie to
+//	m_maskedKmers, where only its count is kept. Also sketches genome into
+//	m_sketches if sketching is on, and filters its k-mers into m_kmerFilters if prefiltering is
+//	on. A frozen index is thawed back into m_seqFragTrie first
 //=================================================================================================
 void GenomeMatcherImpl::addGenome(const Genome& genome)
 {
+	m_resultCache.clear();
+	if (m_frozenIndex != nullptr) {	// the new places can only go in the live index
+		m_frozenIndex->thaw(m_seqFragTrie);
+		m_frozenIndex.reset();
+	}
 	m_genomeList.push_back(genome);
-	for (size_t i = 0; i <= genome.length() - m_minSearchLength; i++) {
+	m_genomeMaxNs.push_back(m_maxIndexedNs);
+	if (m_maxIndexedNs >= 0 && (m_strictestMaxNs < 0 || m_maxIndexedNs < m_strictestMaxNs))
+		m_strictestMaxNs = m_maxIndexedNs;
+	m_sketches.push_back(vector<uint64_t>());
+	const string &sequence = genome.sequence();
+	if (m_sketchScale > 0)
+		buildSketch(sequence, m_sketchScale, m_sketches.back());
+	m_kmerFilters.push_back(buildFilter(sequence));
+
+	int numWindows = (int)sequence.size() - m_minSearchLength + 1;
+	int ns = count(sequence.begin(), sequence.begin() + min((int)sequence.size(), m_minSearchLength - 1), 'N');
+	string fragment;
+	for (int i = 0; i < numWindows; i++) {
+		// keep ns the number of Ns in the window starting at i
+		if (sequence[i + m_minSearchLength - 1] == 'N')
+			ns++;
+		if (i > 0 && sequence[i - 1] == 'N')
+			ns--;
+		if (m_maxIndexedNs >= 0 && ns > m_maxIndexedNs)
+			continue;	// costs one compare per base until the window has left the N run
+
 		SeqFrag sf;
 		sf.genomeIndex = m_genomeList.size() - 1;
 		sf.position = i;
-		string fragment;
-		genome.extract(i, m_minSearchLength, fragment);
-		m_seqFragTrie.insert(fragment, sf);
+		fragment.assign(sequence, i, m_minSearchLength);
+		if (m_maxSeedOccurrences == 0) {
+			m_seqFragTrie.insert(fragment, sf);
+			continue;
+		}
+
+		unordered_map<string, int>::iterator masked = m_maskedKmers.find(fragment);
+		if (masked != m_maskedKmers.end())
+			masked->second++;
+		else {
+			size_t occurrences = m_seqFragTrie.insert(fragment, sf);
+			if (occurrences > (size_t)m_maxSeedOccurrences) {
+				m_seqFragTrie.removeValues(fragment);
+				m_maskedKmers[fragment] = occurrences;
+			}
+		}
+	}
+}
+
+//=================================================================================================
+//	void addGenomesFrom
+//	adds other's genomes as addGenome would, in the order other got them, and leaves other empty.
+//	If sameIndexing says other's index holds what addGenome would have put in this one, it is
+//	merged into m_seqFragTrie with each place moved past this library's genomes, instead of every
+//	window being inserted again. Places in both tries are sorted by genome, so the merged lists
+//	stay sorted. If this library has no genomes yet, nothing needs moving and the tries are just
+//	swapped. Otherwise the genomes are added one at a time
+//=================================================================================================
+void GenomeMatcherImpl::addGenomesFrom(GenomeMatcherImpl& other)
+{
+	if (&other == this)
+		return;
+	if (!sameIndexing(other)) {
+		for (size_t i = 0; i < other.m_genomeList.size(); i++)
+			addGenome(other.m_genomeList[i]);
+		other.clear();
+		return;
+	}
+
+	m_resultCache.clear();
+	if (m_frozenIndex != nullptr) {
+		m_frozenIndex->thaw(m_seqFragTrie);
+		m_frozenIndex.reset();
+	}
+	if (other.m_frozenIndex != nullptr) {
+		other.m_frozenIndex->thaw(other.m_seqFragTrie);
+		other.m_frozenIndex.reset();
+	}
+
+	int offset = (int)m_genomeList.size();
+	if (other.m_strictestMaxNs >= 0 && (m_strictestMaxNs < 0 || other.m_strictestMaxNs < m_strictestMaxNs))
+		m_strictestMaxNs = other.m_strictestMaxNs;
+	if (offset == 0)
+		m_seqFragTrie.swap(other.m_seqFragTrie);
+	else
+		m_seqFragTrie.merge(other.m_seqFragTrie, [offset](SeqFrag &sf) { sf.genomeIndex += offset; });
+	for (size_t i = 0; i < other.m_genomeList.size(); i++) {
+		m_genomeList.push_back(other.m_genomeList[i]);
+		m_genomeMaxNs.push_back(other.m_genomeMaxNs[i]);
+		m_sketches.push_back(vector<uint64_t>());
+		m_sketches.back().swap(other.m_sketches[i]);
+		if (m_prefilterSample > 0 && !other.m_kmerFilters[i].empty())
+			m_kmerFilters.push_back(other.m_kmerFilters[i]);
+		else
+			m_kmerFilters.push_back(buildFilter(other.m_genomeList[i].sequence()));
+	}
+	other.clear();
+}
+
+//=================================================================================================
+//	void addCopiesFrom
+//	adds other's genomes as addGenomesFrom would, but leaves other with them. If its index can be
+//	taken over, a copy of it is merged, which costs a walk of other's tree rather than an insert
+//	per window. A frozen index in other is thawed first
+//=================================================================================================
+void GenomeMatcherImpl::addCopiesFrom(GenomeMatcherImpl& other)
+{
+	if (&other == this || !sameIndexing(other)) {
+		vector<Genome> genomes = other.m_genomeList;	// addGenome may grow m_genomeList if other is this
+		for (size_t i = 0; i < genomes.size(); i++)
+			addGenome(genomes[i]);
+		return;
+	}
+
+	if (other.m_frozenIndex != nullptr) {
+		other.m_frozenIndex->thaw(other.m_seqFragTrie);
+		other.m_frozenIndex.reset();
 	}
+	GenomeMatcherImpl copy(other.m_minSearchLength, other.m_sketchScale);
+	copy.m_genomeList = other.m_genomeList;
+	copy.m_genomeMaxNs = other.m_genomeMaxNs;
+	copy.m_strictestMaxNs = other.m_strictestMaxNs;
+	copy.m_sketches = other.m_sketches;
+	copy.m_kmerFilters = other.m_kmerFilters;
+	copy.m_seqFragTrie.copy(other.m_seqFragTrie);
+	addGenomesFrom(copy);
+}
+
+//=================================================================================================
+//	const vector<Genome>& genomes
+//	returns m_genomeList
+//=================================================================================================
+const vector<Genome>& GenomeMatcherImpl::genomes() const
+{
+	return m_genomeList;
+}
+
+//=================================================================================================
+//	void clear
+//	removes every genome and empties the index, keeping the options
+//=================================================================================================
+void GenomeMatcherImpl::clear()
+{
+	m_resultCache.clear();
+	m_genomeList.clear();
+	m_genomeMaxNs.clear();
+	m_strictestMaxNs = -1;
+	m_sketches.clear();
+	m_kmerFilters.clear();
+	m_maskedKmers.clear();
+	m_seqFragTrie.reset();
+	m_frozenIndex.reset();
 }
 
 //=================================================================================================
@@ -81,178 +487,1909 @@ int GenomeMatcherImpl::minimumSearchLength() const
 //=================================================================================================
 //	bool findGenomesWithThisDNA
 //	adds any portions of DNA that match fragment up to at least minimumLength to matches and
-//	returns true. if no matches found or invalid parameters, returns false.
+//	returns true. if no matches found or invalid parameters, returns false. Also searches for
+//	fragment's reverse complement if bothStrands is true. Answers from m_resultCache if it is on
+//	and the same query was made recently
 //=================================================================================================
-bool GenomeMatcherImpl::findGenomesWithThisDNA(const string& fragment, int minimumLength, bool exactMatchOnly, vector<DNAMatch>& matches) const
+bool GenomeMatcherImpl::findGenomesWithThisDNA(const string& fragment, int minimumLength, bool exactMatchOnly, vector<DNAMatch>& matches, bool bothStrands) const
 {
-	// invalid cases
-	if (fragment.size() < minimumLength || minimumLength < m_minSearchLength)
-		return false;
+	bool found;
+	bool cached = m_resultCache.enabled();
+	if (cached && m_resultCache.find(fragment, minimumLength, exactMatchOnly, bothStrands, matches, found))
+		return found;
 
-	vector<DNAMatch> matchHolder;
-	vector<SeqFrag> tempMatches = m_seqFragTrie.find(fragment.substr(0, m_minSearchLength), exactMatchOnly);
-	
-	// adds any relevant matches to matchHolder
-	for (size_t i = 0; i < tempMatches.size(); i++) {
-		DNAMatch match = findMatch(fragment, tempMatches[i], exactMatchOnly);
-		int repl;
-		if (sameGenome(match, matchHolder, repl)) {
-			if (match.length > matchHolder[repl].length)
-				matchHolder[repl] = match;
-		}
-		else if(match.length >= minimumLength)
-			matchHolder.push_back(match);
-	}
+	vector<DNAMatch> newMatches;
+	if (bothStrands)
+		found = searchBothStrands(fragment, minimumLength, exactMatchOnly ? 0 : 1, newMatches);
+	else
+		found = findGenomesWithMismatches(fragment, minimumLength, exactMatchOnly ? 0 : 1, newMatches);
+	if (cached)
+		m_resultCache.store(fragment, minimumLength, exactMatchOnly, bothStrands, newMatches, found);
+	matches.insert(matches.end(), newMatches.begin(), newMatches.end());
+	return found;
+}
 
-	// checks if anything was added to matchHolder and returns
-	matches.insert(matches.end(), matchHolder.begin(), matchHolder.end());
-	return !matchHolder.empty();
+//=================================================================================================
+//	bool findGenomesWithMismatches
+//	same as findGenomesWithThisDNA, but a match may contain up to maxMismatches SNiPs (excluding
+//	the first char) instead of at most one. Seeds come from the fragment's first k-mer unless
+//	planSeeds finds k-mers further in that are found in fewer places
+//=================================================================================================
+bool GenomeMatcherImpl::findGenomesWithMismatches(const string& fragment, int minimumLength, int maxMismatches, vector<DNAMatch>& matches) const
+{
+	vector<Hit> hits;
+	if (!searchFragment(fragment, minimumLength, maxMismatches, nullptr, nullptr, hits))
+		return false;
+	addMatches(hits, matches);
+	return true;
+}
+
+//=================================================================================================
+//	bool findGenomesWithMismatchesBatch
+//	does findGenomesWithMismatches for every fragment at once, adding the matches of fragments[i]
+//	to matches[i]. Seeds are looked up together so shared trie paths are walked once. Returns true if
+//	any fragment had a match, false if none did or minimumLength is invalid.
+//=================================================================================================
+bool GenomeMatcherImpl::findGenomesWithMismatchesBatch(const vector<string>& fragments, int minimumLength, int maxMismatches, vector<vector<DNAMatch>>& matches) const
+{
+	vector<vector<Hit>> hits;
+	bool found = searchBatch(fragments, minimumLength, maxMismatches, nullptr, hits);
+	matches.resize(fragments.size());
+	for (size_t i = 0; i < hits.size(); i++)
+		addMatches(hits[i], matches[i]);
+	return found;
 }
 
 //=================================================================================================
 //	bool findRelatedGenomes
 //	adds any genomes that match query's dna sequence with a percentage greater than
 //	matchPercentThreshold and returns true. if no genomes have a large enough match percentage or
-//	invalid parameters, return false.
+//	invalid parameters, return false. If bothStrands is true, a fragment of query also counts
+//	for a genome its reverse complement matches. If prefiltering is on, only the genomes prefilter
+//	lets through are searched
 //=================================================================================================
-bool GenomeMatcherImpl::findRelatedGenomes(const Genome& query, int fragmentMatchLength, bool exactMatchOnly, double matchPercentThreshold, vector<GenomeMatch>& results) const
+bool GenomeMatcherImpl::findRelatedGenomes(const Genome& query, int fragmentMatchLength, bool exactMatchOnly, double matchPercentThreshold, vector<GenomeMatch>& results, bool bothStrands) const
 {
 	// invalid case
 	if (fragmentMatchLength < m_minSearchLength)
 		return false;
 
-	int numFrags = query.length() / fragmentMatchLength;
-	vector<DNAMatch> matches;
-	vector<GenomeMatch> matchHolder;
+	int maxMismatches = exactMatchOnly ? 0 : 1;
+	if (m_prefilterSample == 0)
+		return relatedAmong(query, fragmentMatchLength, maxMismatches, matchPercentThreshold, nullptr, bothStrands, results);
 
-	//adds all DNA matches to matches
-	for (size_t i = 0; i < numFrags; i++) {
-		string fragment;
-		query.extract(i*fragmentMatchLength, fragmentMatchLength, fragment);
-		findGenomesWithThisDNA(fragment, fragmentMatchLength, exactMatchOnly, matches);
+	vector<bool> allowed;
+	if (!prefilter(query, fragmentMatchLength, maxMismatches, matchPercentThreshold, bothStrands, allowed))
+		return false;
+	return relatedAmong(query, fragmentMatchLength, maxMismatches, matchPercentThreshold, &allowed, bothStrands, results);
+}
+
+//=================================================================================================
+//	bool findRelatedPercentages
+//	sets percents[i] to the percentage of query's fragments, counted as findRelatedGenomes counts
+//	them, that match the name of m_genomeList[i], with no threshold and no prefilter. Returns false
+//	if fragmentMatchLength is too short or query has no fragments
+//=================================================================================================
+bool GenomeMatcherImpl::findRelatedPercentages(const Genome& query, int fragmentMatchLength, bool exactMatchOnly, vector<double>& percents, bool bothStrands) const
+{
+	// invalid case
+	if (fragmentMatchLength < m_minSearchLength)
+		return false;
+
+	unordered_map<const string*, int> numMatches;
+	int numFrags = countMatches(query, fragmentMatchLength, exactMatchOnly ? 0 : 1, nullptr, bothStrands, numMatches);
+	if (numFrags == 0)
+		return false;
+
+	percents.assign(m_genomeList.size(), 0);
+	for (size_t i = 0; i < m_genomeList.size(); i++) {
+		unordered_map<const string*, int>::const_iterator count = numMatches.find(&m_genomeList[i].name());
+		if (count != numMatches.end())
+			percents[i] = (double)count->second / numFrags * 100;
 	}
+	return true;
+}
 
-	// determines match percentage and adds matches over matchPercentThreshold to matchHolder
+//=================================================================================================
+//	bool findRelatedGenomesSketch
+//	like findRelatedGenomes, but estimates each genome's match percentage from the share of the
+//	query's sketch found in the genome's sketch. If verifyTop is positive, only the verifyTop
+//	genomes with the best estimates are then searched with the exact fragment method and reported
+//	with their exact percentages. Falls back to findRelatedGenomes if sketching is off
+//=================================================================================================
+bool GenomeMatcherImpl::findRelatedGenomesSketch(const Genome& query, int fragmentMatchLength, bool exactMatchOnly, double matchPercentThreshold, int verifyTop, vector<GenomeMatch>& results) const
+{
+	// invalid case
+	if (fragmentMatchLength < m_minSearchLength)
+		return false;
+	if (m_sketchScale == 0)
+		return findRelatedGenomes(query, fragmentMatchLength, exactMatchOnly, matchPercentThreshold, results, false);
+
+	vector<uint64_t> querySketch;
+	buildSketch(query.sequence(), m_sketchScale, querySketch);
+	if (querySketch.empty())	// query too short or too unlucky to estimate anything
+		return false;
+
+	// estimate the containment of the query in each genome
+	vector<pair<double, int>> estimates;	// (estimated percentage, genome index)
 	for (size_t i = 0; i < m_genomeList.size(); i++) {
-		double percentage = (double)numMatches(matches, m_genomeList[i].name()) / numFrags * 100;
-		if (percentage > matchPercentThreshold) {
+		int shared = sharedHashes(querySketch, m_sketches[i]);
+		if (shared > 0)
+			estimates.push_back(make_pair((double)shared / querySketch.size() * 100, (int)i));
+	}
+
+	if (verifyTop > 0) {	// re-check only the most promising genomes with the exact method
+		sort(estimates.begin(), estimates.end(), [](const pair<double, int> &a, const pair<double, int> &b) {
+			return a.first > b.first || (a.first == b.first && a.second < b.second);
+		});
+		vector<bool> allowed(m_genomeList.size(), false);
+		for (size_t i = 0; i < estimates.size() && i < (size_t)verifyTop; i++)
+			allowed[estimates[i].second] = true;
+		return relatedAmong(query, fragmentMatchLength, exactMatchOnly ? 0 : 1, matchPercentThreshold, &allowed, false, results);
+	}
+
+	vector<GenomeMatch> matchHolder;
+	for (size_t i = 0; i < estimates.size(); i++) {
+		if (estimates[i].first > matchPercentThreshold) {
 			GenomeMatch gm;
-			gm.genomeName = m_genomeList[i].name();
-			gm.percentMatch = percentage;
+			gm.genomeName = m_genomeList[estimates[i].second].name();
+			gm.percentMatch = estimates[i].first;
 			insertMatch(gm, matchHolder);
 		}
 	}
 
-	// check if anything was added to matchHolder and returns
 	results.insert(results.end(), matchHolder.begin(), matchHolder.end());
 	return !matchHolder.empty();
 }
 
+//=================================================================================================
+//	void setResultCacheCapacity
+//	keeps the results of up to capacity recent findGenomesWithThisDNA queries, or none if capacity
+//	is not positive, forgetting those kept so far
+//=================================================================================================
+void GenomeMatcherImpl::setResultCacheCapacity(int capacity)
+{
+	m_resultCache.setCapacity(max(capacity, 0));
+}
+
+//=================================================================================================
+//	long long resultCacheHits / resultCacheMisses
+//	return how many findGenomesWithThisDNA queries were and were not answered from the cache while
+//	it was on
+//=================================================================================================
+long long GenomeMatcherImpl::resultCacheHits() const
+{
+	return m_resultCache.hits();
+}
+
+long long GenomeMatcherImpl::resultCacheMisses() const
+{
+	return m_resultCache.misses();
+}
+
+//=================================================================================================
+//	void setMaxIndexedNs
+//	sets m_maxIndexedNs for the genomes added from now on. Any negative maxNs means every window
+//	is indexed
+//=================================================================================================
+void GenomeMatcherImpl::setMaxIndexedNs(int maxNs)
+{
+	m_maxIndexedNs = max(maxNs, -1);
+}
+
+//=================================================================================================
+//	void setMaxSeedOccurrences
+//	sets m_maxSeedOccurrences for the genomes added from now on. Any maxOccurrences less than 1
+//	means no k-mer is masked
+//=================================================================================================
+void GenomeMatcherImpl::setMaxSeedOccurrences(int maxOccurrences)
+{
+	m_maxSeedOccurrences = max(maxOccurrences, 0);
+}
+
+//=================================================================================================
+//	void setFragmentStride
+//	sets m_fragmentStride for the findRelatedGenomes queries made from now on. Any stride less
+//	than 1 means back to back fragments
+//=================================================================================================
+void GenomeMatcherImpl::setFragmentStride(int stride)
+{
+	m_fragmentStride = max(stride, 0);
+}
+
+//=================================================================================================
+//	void setRelatedPrefilter
+//	sets m_prefilterSample. Genomes added from now on get a k-mer filter if it is positive; any
+//	sampleFragments less than 1 turns prefiltering off
+//=================================================================================================
+void GenomeMatcherImpl::setRelatedPrefilter(int sampleFragments)
+{
+	m_prefilterSample = max(sampleFragments, 0);
+}
+
+//=================================================================================================
+//	void freezeIndex
+//	moves the posting lists from m_seqFragTrie into a FrozenIndex, emptying m_seqFragTrie.
+//	Queries give the same results either way. Does nothing if the index is already frozen
+//=================================================================================================
+void GenomeMatcherImpl::freezeIndex()
+{
+	if (m_frozenIndex != nullptr)
+		return;
+	m_frozenIndex.reset(new FrozenIndex(m_seqFragTrie));
+}
+
 //=================================================================================================
 //	PRIVATE MEMBERS
 //=================================================================================================
 
 //=================================================================================================
-//	DNAMatch findMatch
-//	finds the length of the given match and returns a DNAMatch object of that match
+//	bool searchFragment
+//	does findGenomesWithMismatches into hits, skipping genomes that are not marked in allowed
+//	unless allowed is nullptr. The plan's k-mers are looked up through cache unless it is nullptr
 //=================================================================================================
-DNAMatch GenomeMatcherImpl::findMatch(const string &fragment, const SeqFrag &match, bool exactMatchOnly) const {
-	// determine the fragment of the genome that should be checked
-	int glength = min((int)fragment.size(), m_genomeList[match.genomeIndex].length() - match.position);
-	string gfrag;
-	m_genomeList[match.genomeIndex].extract(match.position, glength, gfrag);
-	int length = 0;
-
-	// determine the length of the match
-	for (size_t i = 0; i < gfrag.size(); i++) {
-		if (!exactMatchOnly && fragment[i] != gfrag[i])
-			exactMatchOnly = true;
-		else if (fragment[i] != gfrag[i])
-			break;
-		length++;
+bool GenomeMatcherImpl::searchFragment(const string &fragment, int minimumLength, int maxMismatches, const vector<bool> *allowed, KmerCache *cache, vector<Hit> &hits) const {
+	// invalid cases
+	if (fragment.size() < minimumLength || minimumLength < m_minSearchLength || maxMismatches < 0)
+		return false;
+
+	string seed = fragment.substr(0, m_minSearchLength);
+	vector<int> offsets;
+	vector<SeqFrag> tempMatches;
+	if (planSeeds(fragment, minimumLength, maxMismatches, cache, offsets))
+		seedFromPlan(fragment, offsets, cache, tempMatches);
+	else if (!isMasked(seed))
+		tempMatches = findSeeds(seed, maxMismatches);
+	return collectMatches(fragment, minimumLength, maxMismatches, tempMatches, allowed, hits);
+}
+
+//=================================================================================================
+//	bool searchBatch
+//	does findGenomesWithMismatchesBatch into hits, skipping genomes that are not marked in allowed
+//	unless allowed is nullptr
+//=================================================================================================
+bool GenomeMatcherImpl::searchBatch(const vector<string> &fragments, int minimumLength, int maxMismatches, const vector<bool> *allowed, vector<vector<Hit>> &hits) const {
+	hits.resize(fragments.size());
+
+	// invalid cases
+	if (minimumLength < m_minSearchLength || maxMismatches < 0)
+		return false;
+
+	// fragments that are too short, are seeded from a plan or start with a masked k-mer get an
+	// empty seed, which findBatchWithMismatches skips
+	vector<string> seeds(fragments.size());
+	vector<vector<int>> plans(fragments.size());	// seed offsets of planned fragments
+	for (size_t i = 0; i < fragments.size(); i++) {
+		if (fragments[i].size() < (size_t)minimumLength)
+			continue;
+		seeds[i] = fragments[i].substr(0, m_minSearchLength);
+		if (planSeeds(fragments[i], minimumLength, maxMismatches, nullptr, plans[i]) || isMasked(seeds[i]))
+			seeds[i].clear();
 	}
 
-	// create the DNAMatch object
-	DNAMatch m;
-	m.genomeName = m_genomeList[match.genomeIndex].name();
-	m.length = length;
-	m.position = match.position;
-	return m;
+	vector<vector<SeqFrag>> tempMatches;
+	findSeedsBatch(seeds, maxMismatches, tempMatches);
+
+	bool found = false;
+	for (size_t i = 0; i < fragments.size(); i++) {
+		if (!plans[i].empty())
+			seedFromPlan(fragments[i], plans[i], nullptr, tempMatches[i]);
+		else if (seeds[i].empty())
+			continue;
+		if (collectMatches(fragments[i], minimumLength, maxMismatches, tempMatches[i], allowed, hits[i]))
+			found = true;
+	}
+	return found;
 }
 
 //=================================================================================================
-//	bool sameGenome
-//	returns true if existingMatches already contains a DNAMatch with the same name as newMatch and
-//	sets genomeInd to its index. Otherwise, returns false and leaves genomeInd unchanged.
+//	bool relatedAmong
+//	does the work of findRelatedGenomes, only considering genomes marked in allowed unless allowed
+//	is nullptr. Fragments start every m_fragmentStride bases if it is set, and back to back if not
 //=================================================================================================
-bool GenomeMatcherImpl::sameGenome(const DNAMatch &newMatch, const vector<DNAMatch> &existingMatches, int &genomeInd) const {
-	for (size_t i = 0; i < existingMatches.size(); i++) {
-		if (newMatch.genomeName == existingMatches[i].genomeName) {
-			genomeInd = i;
-			return true;
+bool GenomeMatcherImpl::relatedAmong(const Genome &query, int fragmentMatchLength, int maxMismatches, double matchPercentThreshold, const vector<bool> *allowed, bool bothStrands, vector<GenomeMatch> &results) const {
+	unordered_map<const string*, int> numMatches;	// matched fragments per interned genome name
+	vector<GenomeMatch> matchHolder;
+
+	// counts the fragments that match each genome name
+	int numFrags = countMatches(query, fragmentMatchLength, maxMismatches, allowed, bothStrands, numMatches);
+
+	// determines match percentage and adds matches over matchPercentThreshold to matchHolder
+	for (size_t i = 0; i < m_genomeList.size(); i++) {
+		if (allowed != nullptr && !(*allowed)[i])
+			continue;
+		unordered_map<const string*, int>::const_iterator count = numMatches.find(&m_genomeList[i].name());
+		double percentage = (double)(count == numMatches.end() ? 0 : count->second) / numFrags * 100;
+		if (percentage > matchPercentThreshold) {
+			GenomeMatch gm;
+			gm.genomeName = m_genomeList[i].name();
+			gm.percentMatch = percentage;
+			insertMatch(gm, matchHolder);
 		}
 	}
-	return false;
+
+	// check if anything was added to matchHolder and returns
+	results.insert(results.end(), matchHolder.begin(), matchHolder.end());
+	return !matchHolder.empty();
 }
 
 //=================================================================================================
-//	int numMatches
-//	returns the number of matches in allMatches that have the name genomeName
+//	int countMatches
+//	counts in numMatches the fragments of query that match each genome name with
+//	countWindowMatches if m_fragmentStride is set, or countFragmentMatches if not, and returns the
+//	number of fragments
 //=================================================================================================
-int GenomeMatcherImpl::numMatches(const vector<DNAMatch> &allMatches, const string &genomeName) const {
-	int count = 0;
-	for (size_t i = 0; i < allMatches.size(); i++) {
-		if (allMatches[i].genomeName == genomeName)
-			count++;
-	}
-	return count;
+int GenomeMatcherImpl::countMatches(const Genome &query, int fragmentMatchLength, int maxMismatches, const vector<bool> *allowed, bool bothStrands, unordered_map<const string*, int> &numMatches) const {
+	if (m_fragmentStride > 0)
+		return countWindowMatches(query, fragmentMatchLength, maxMismatches, allowed, bothStrands, numMatches);
+	return countFragmentMatches(query, fragmentMatchLength, maxMismatches, allowed, bothStrands, numMatches);
 }
 
 //=================================================================================================
-//	void insertMatch
-//	inserts match into allMatches to maintain descending order of percentMatches
+//	int countFragmentMatches
+//	counts in numMatches the back to back fragments of query that match each genome name, and
+//	returns the number of fragments. With bothStrands, every fragment's reverse complement is
+//	searched in the same batch, and each fragment counts once per genome name either matches
 //=================================================================================================
-void GenomeMatcherImpl::insertMatch(const GenomeMatch &match, vector<GenomeMatch> &allMatches) const {
-	vector<GenomeMatch>::iterator it;
-	for (it = allMatches.begin(); it != allMatches.end(); it++) {
-		if (match.percentMatch > it->percentMatch || match.percentMatch == it->percentMatch && match.genomeName < it->genomeName)
-			break;
+int GenomeMatcherImpl::countFragmentMatches(const Genome &query, int fragmentMatchLength, int maxMismatches, const vector<bool> *allowed, bool bothStrands, unordered_map<const string*, int> &numMatches) const {
+	int numFrags = query.length() / fragmentMatchLength;
+	vector<string> fragments(bothStrands ? 2 * numFrags : numFrags);	// reverse complements follow
+	vector<vector<Hit>> fragHits;
+
+	for (size_t i = 0; i < numFrags; i++) {
+		query.extract(i*fragmentMatchLength, fragmentMatchLength, fragments[i]);
+		if (bothStrands)
+			reverseComplement(fragments[i], fragments[numFrags + i]);
 	}
-	allMatches.insert(it, match);
+	searchBatch(fragments, fragmentMatchLength, maxMismatches, allowed, fragHits);
+	for (size_t i = 0; i < numFrags; i++) {
+		if (bothStrands)
+			mergeStrands(fragHits[numFrags + i], fragHits[i]);
+		for (size_t j = 0; j < fragHits[i].size(); j++)
+			numMatches[fragHits[i][j].genomeName]++;
+	}
+	return numFrags;
 }
 
+//=================================================================================================
+//	int countWindowMatches
+//	like countFragmentMatches, but for the windows of fragmentMatchLength bases that start every
+//	m_fragmentStride bases, which overlap when the stride is shorter. The windows are copied
+//	straight out of query's sequence and searched one after another, each through a KmerCache of
+//	its strand so that the k-mers planSeeds weighs and seedFromPlan looks up are shared with the
+//	windows around it instead of being looked up again by each one
+//=================================================================================================
+int GenomeMatcherImpl::countWindowMatches(const Genome &query, int fragmentMatchLength, int maxMismatches, const vector<bool> *allowed, bool bothStrands, unordered_map<const string*, int> &numMatches) const {
+	const string &sequence = query.sequence();
+	int length = (int)sequence.size();
+	if (length < fragmentMatchLength)
+		return 0;
 
-//******************** GenomeMatcher functions ********************************
-
-// These functions simply delegate to GenomeMatcherImpl's functions.
-// You probably don't want to change any of this code.
+	int numWindows = (length - fragmentMatchLength) / m_fragmentStride + 1;
+	string complement;	// the reverse complement of the whole query, whose windows run backward
+	if (bothStrands)
+		reverseComplement(sequence, complement);
 
-GenomeMatcher::GenomeMatcher(int minSearchLength)
-{
-	m_impl = new GenomeMatcherImpl(minSearchLength);
+	KmerCache forwardCache, reverseCache;
+	string window;
+	vector<Hit> hits, reverseHits;
+	for (int i = 0; i < numWindows; i++) {
+		int start = i * m_fragmentStride;
+		hits.clear();
+		forwardCache.moveTo(start, fragmentMatchLength);
+		window.assign(sequence, start, fragmentMatchLength);
+		searchFragment(window, fragmentMatchLength, maxMismatches, allowed, &forwardCache, hits);
+		if (bothStrands) {
+			int reverseStart = length - fragmentMatchLength - start;
+			reverseHits.clear();
+			reverseCache.moveTo(reverseStart, fragmentMatchLength);
+			window.assign(complement, reverseStart, fragmentMatchLength);
+			searchFragment(window, fragmentMatchLength, maxMismatches, allowed, &reverseCache, reverseHits);
+			mergeStrands(reverseHits, hits);
+		}
+		for (size_t j = 0; j < hits.size(); j++)
+			numMatches[hits[j].genomeName]++;
+	}
+	return numWindows;
 }
 
-GenomeMatcher::~GenomeMatcher()
-{
-	delete m_impl;
+//=================================================================================================
+//	void KmerCache::moveTo
+//	starts searching the window at windowStart, forgetting the k-mers that do not start in it
+//=================================================================================================
+void GenomeMatcherImpl::KmerCache::moveTo(int windowStart, int windowLength) {
+	start = windowStart;
+	costs.erase(costs.begin(), costs.lower_bound(windowStart));
+	costs.erase(costs.lower_bound(windowStart + windowLength), costs.end());
+	places.erase(places.begin(), places.lower_bound(windowStart));
+	places.erase(places.lower_bound(windowStart + windowLength), places.end());
 }
 
-void GenomeMatcher::addGenome(const Genome& genome)
-{
-	m_impl->addGenome(genome);
+//=================================================================================================
+//	KmerFilter buildFilter
+//	returns the filter of sequence's k-mers if prefiltering is on, or an empty filter if it is off
+//=================================================================================================
+KmerFilter GenomeMatcherImpl::buildFilter(const string &sequence) const {
+	if (m_prefilterSample == 0)
+		return KmerFilter();
+	vector<uint64_t> hashes;
+	hashKmers(sequence, m_minSearchLength, hashes);
+	return KmerFilter(hashes);
 }
 
-int GenomeMatcher::minimumSearchLength() const
-{
+//=================================================================================================
+//	bool sameIndexing
+//	returns true if other indexed and sketched its genomes exactly as this library would now, so
+//	its index and sketches can be taken over. Masking depends on the counts over every genome, so
+//	libraries that mask k-mers never qualify
+//=================================================================================================
+bool GenomeMatcherImpl::sameIndexing(const GenomeMatcherImpl &other) const {
+	if (m_minSearchLength != other.m_minSearchLength || m_sketchScale != other.m_sketchScale
+		|| m_maxSeedOccurrences != 0 || other.m_maxSeedOccurrences != 0)
+		return false;
+	for (size_t i = 0; i < other.m_genomeMaxNs.size(); i++) {
+		if (other.m_genomeMaxNs[i] != m_maxIndexedNs)
+			return false;
+	}
+	return true;
+}
+
+//=================================================================================================
+//	bool prefilter
+//	marks in allowed the genomes whose k-mer filters say they could still pass
+//	matchPercentThreshold, and returns false if none could. Up to m_prefilterSample of the
+//	fragments relatedAmong would search, spread evenly over query, are checked with mayMatch
+//	against each genome, and a genome name is dropped if the share of them that could match it is
+//	not over matchPercentThreshold. That share is exact when no fragment is left out of the
+//	sample, and otherwise an estimate
+//=================================================================================================
+bool GenomeMatcherImpl::prefilter(const Genome &query, int fragmentMatchLength, int maxMismatches, double matchPercentThreshold, bool bothStrands, vector<bool> &allowed) const {
+	const string &sequence = query.sequence();
+	int step = m_fragmentStride > 0 ? m_fragmentStride : fragmentMatchLength;
+	int numFrags = (int)sequence.size() < fragmentMatchLength ? 0 : ((int)sequence.size() - fragmentMatchLength) / step + 1;
+	int sampled = min(numFrags, m_prefilterSample);
+	if (sampled == 0)
+		return false;
+
+	// hashes the k-mers of each sampled fragment, then those of their reverse complements
+	int kmersPerFrag = fragmentMatchLength - m_minSearchLength + 1;
+	int numStrands = bothStrands ? 2 : 1;
+	vector<uint64_t> hashes, fragHashes;
+	string fragment, complement;
+	for (int s = 0; s < numStrands; s++) {
+		for (int i = 0; i < sampled; i++) {
+			fragment.assign(sequence, (size_t)((long long)i * numFrags / sampled) * step, fragmentMatchLength);
+			if (s == 1) {
+				reverseComplement(fragment, complement);
+				fragment.swap(complement);
+			}
+			hashKmers(fragment, m_minSearchLength, fragHashes);
+			hashes.insert(hashes.end(), fragHashes.begin(), fragHashes.end());
+		}
+	}
+
+	// marks the sampled fragments that could match each genome name
+	unordered_map<const string*, vector<bool>> couldMatch;
+	for (size_t g = 0; g < m_genomeList.size(); g++) {
+		vector<bool> &fragments = couldMatch[&m_genomeList[g].name()];
+		fragments.resize(sampled);
+		for (int i = 0; i < sampled; i++) {
+			for (int s = 0; s < numStrands && !fragments[i]; s++)
+				fragments[i] = mayMatch(m_kmerFilters[g], &hashes[((size_t)s * sampled + i) * kmersPerFrag], kmersPerFrag, maxMismatches);
+		}
+	}
+
+	bool any = false;
+	allowed.assign(m_genomeList.size(), false);
+	for (size_t g = 0; g < m_genomeList.size(); g++) {
+		const vector<bool> &fragments = couldMatch[&m_genomeList[g].name()];
+		double percentage = (double)count(fragments.begin(), fragments.end(), true) / sampled * 100;
+		if (percentage > matchPercentThreshold) {
+			allowed[g] = true;
+			any = true;
+		}
+	}
+	return any;
+}
+
+//=================================================================================================
+//	bool mayMatch
+//	returns false if the fragment whose k-mers' hashes are the count in hashes cannot match the
+//	genome of filter. A match with up to maxMismatches SNiPs leaves at most maxMismatches of the
+//	fragment's side by side k-mers, and maxMismatches * k of all its k-mers, missing from the
+//	genome, since each SNiP is in at most k of them. The side by side k-mers are checked first, as
+//	they rule a match out soonest, and the rest only while enough are left to rule it out
+//=================================================================================================
+bool GenomeMatcherImpl::mayMatch(const KmerFilter &filter, const uint64_t *hashes, int count, int maxMismatches) const {
+	int missing = 0;	// k-mers missing from the filter
+	int left = count;	// k-mers not checked yet
+	int missingApart = 0;	// side by side k-mers missing from the filter
+	for (int j = 0; j < count; j += m_minSearchLength) {
+		left--;
+		if (!filter.mayContain(hashes[j])) {
+			missing++;
+			if (++missingApart > maxMismatches)
+				return false;
+		}
+	}
+
+	for (int j = 0; j < count && missing + left > maxMismatches * m_minSearchLength; j++) {
+		if (j % m_minSearchLength == 0)
+			continue;
+		left--;
+		if (!filter.mayContain(hashes[j]) && ++missing > maxMismatches * m_minSearchLength)
+			return false;
+	}
+	return true;
+}
+
+//=================================================================================================
+//	vector<SeqFrag> findSeeds
+//	returns the places of every indexed k-mer within maxMismatches SNiPs of kmer
+//=================================================================================================
+vector<GenomeMatcherImpl::SeqFrag> GenomeMatcherImpl::findSeeds(const string &kmer, int maxMismatches) const {
+	if (m_frozenIndex != nullptr)
+		return m_frozenIndex->find(kmer, maxMismatches);
+	return m_seqFragTrie.findWithMismatches(kmer, maxMismatches);
+}
+
+//=================================================================================================
+//	void findSeedsBatch
+//	sets seeds[i] to what findSeeds would return for kmers[i], or to nothing if kmers[i] is empty
+//=================================================================================================
+void GenomeMatcherImpl::findSeedsBatch(const vector<string> &kmers, int maxMismatches, vector<vector<SeqFrag>> &seeds) const {
+	if (m_frozenIndex != nullptr)
+		m_frozenIndex->findBatch(kmers, maxMismatches, seeds);
+	else
+		m_seqFragTrie.findBatchWithMismatches(kmers, maxMismatches, seeds);
+}
+
+//=================================================================================================
+//	size_t countSeeds
+//	returns how many places findSeeds would return, without listing them
+//=================================================================================================
+size_t GenomeMatcherImpl::countSeeds(const string &kmer, int maxMismatches) const {
+	if (m_frozenIndex != nullptr)
+		return m_frozenIndex->count(kmer, maxMismatches);
+	return m_seqFragTrie.countWithMismatches(kmer, maxMismatches);
+}
+
+//=================================================================================================
+//	bool isMasked
+//	returns true if kmer was found too often to be indexed
+//=================================================================================================
+bool GenomeMatcherImpl::isMasked(const string &kmer) const {
+	return !m_maskedKmers.empty() && m_maskedKmers.find(kmer) != m_maskedKmers.end();
+}
+
+//=================================================================================================
+//	bool isIndexed
+//	returns true if every place kmer is found is in m_seqFragTrie: it only holds chars the trie's
+//	DnaAlphabet has, is not masked and does not have more Ns than any genome was indexed with.
+//	setMaxIndexedNs only applies to the genomes added after it, so this is the strictest of their
+//	limits and not m_maxIndexedNs
+//=================================================================================================
+bool GenomeMatcherImpl::isIndexed(const string &kmer) const {
+	return kmer.find_first_not_of("ACGTN") == string::npos && !isMasked(kmer)
+		&& (m_strictestMaxNs < 0 || count(kmer.begin(), kmer.end(), 'N') <= m_strictestMaxNs);
+}
+
+//=================================================================================================
+//	bool isIndexedIn
+//	returns true if kmer was put in m_seqFragTrie where it is found in m_genomeList[genomeIndex]:
+//	it only holds chars the trie's DnaAlphabet has, is not masked and does not have more Ns than
+//	that genome was indexed with
+//=================================================================================================
+bool GenomeMatcherImpl::isIndexedIn(const string &kmer, int genomeIndex) const {
+	int maxNs = m_genomeMaxNs[genomeIndex];
+	return kmer.find_first_not_of("ACGTN") == string::npos && !isMasked(kmer)
+		&& (maxNs < 0 || count(kmer.begin(), kmer.end(), 'N') <= maxNs);
+}
+
+//=================================================================================================
+//	bool planSeeds
+//	decides where fragment's seeds should come from. Any match has at most maxMismatches SNiPs in
+//	its first minimumLength chars, so one of any maxMismatches + 1 side by side k-mers there
+//	matches exactly, and looking each of them up exactly finds every match. Compares the sizes of
+//	the posting lists of up to MAX_PLANNED_RUNS such runs of k-mers, spread over the first
+//	minimumLength chars, with the number of seeds the first k-mer gives on its own. If a run is
+//	cheaper, sets offsets to where its k-mers start in fragment and returns true. Only indexed
+//	k-mers are used, so a fragment starting with a masked k-mer is planned whenever any run has
+//	none. The runs' k-mers are counted through cache unless it is nullptr
+//=================================================================================================
+bool GenomeMatcherImpl::planSeeds(const string &fragment, int minimumLength, int maxMismatches, KmerCache *cache, vector<int> &offsets) const {
+	int span = (maxMismatches + 1) * m_minSearchLength;	// chars covered by a run of k-mers
+	int lastShift = minimumLength - span;	// last place a run may start
+	string kmer = fragment.substr(0, m_minSearchLength);
+	size_t bestCost = isMasked(kmer) ? SIZE_MAX : countSeeds(kmer, maxMismatches);
+	if (lastShift < 0 || bestCost < MIN_PLANNED_SEEDS)
+		return false;
+
+	int runs = min(lastShift + 1, MAX_PLANNED_RUNS);
+	bool planned = false;
+	for (int r = 0; r < runs; r++) {
+		int shift = runs == 1 ? 0 : r * lastShift / (runs - 1);
+		size_t cost = 0;
+		for (int j = 0; j <= maxMismatches && cost < bestCost; j++) {
+			size_t kmerCost = exactCost(fragment, shift + j * m_minSearchLength, cache);
+			cost = kmerCost == SIZE_MAX ? SIZE_MAX : cost + kmerCost;
+		}
+		if (cost < bestCost) {
+			bestCost = cost;
+			planned = true;
+			offsets.clear();
+			for (int j = 0; j <= maxMismatches; j++)
+				offsets.push_back(shift + j * m_minSearchLength);
+		}
+	}
+	return planned;
+}
+
+//=================================================================================================
+//	void seedFromPlan
+//	sets candidates to the seeds of fragment's matches found by looking up exactly the k-mers that
+//	start at offsets. Each place a k-mer is found becomes the genome position the fragment would
+//	start at, from which findMatch extends back over the chars before the k-mer and on past it.
+//	Candidates are sorted by genome and position and are only kept where the trie could have
+//	given them as seeds: the genome's k-mer there must start with the fragment's first char and
+//	be indexed, though it may be masked if the fragment's first k-mer is too. The k-mers are looked
+//	up through cache unless it is nullptr
+//=================================================================================================
+void GenomeMatcherImpl::seedFromPlan(const string &fragment, const vector<int> &offsets, KmerCache *cache, vector<SeqFrag> &candidates) const {
+	candidates.clear();
+	bool firstMasked = isMasked(fragment.substr(0, m_minSearchLength));
+	string window;	// the genome's k-mer where a candidate starts
+	vector<SeqFrag> uncached;
+	for (size_t j = 0; j < offsets.size(); j++) {
+		const vector<SeqFrag> &found = exactPlaces(fragment, offsets[j], cache, uncached);
+		for (size_t f = 0; f < found.size(); f++) {
+			SeqFrag sf = found[f];
+			sf.position -= offsets[j];
+			if (sf.position < 0 || !m_genomeList[sf.genomeIndex].extract(sf.position, m_minSearchLength, window) || window[0] != fragment[0])
+				continue;
+			if (isIndexedIn(window, sf.genomeIndex) || (firstMasked && isMasked(window)))
+				candidates.push_back(sf);
+		}
+	}
+	sort(candidates.begin(), candidates.end(), [](const SeqFrag &a, const SeqFrag &b) {
+		return a.genomeIndex < b.genomeIndex || (a.genomeIndex == b.genomeIndex && a.position < b.position);
+	});
+	candidates.erase(unique(candidates.begin(), candidates.end(), [](const SeqFrag &a, const SeqFrag &b) {
+		return a.genomeIndex == b.genomeIndex && a.position == b.position;
+	}), candidates.end());
+}
+
+//=================================================================================================
+//	size_t exactCost
+//	returns how many places the k-mer of fragment at offset is found in exactly, or SIZE_MAX if it
+//	is not indexed. If cache is not nullptr, each place in its sequence is only counted once
+//=================================================================================================
+size_t GenomeMatcherImpl::exactCost(const string &fragment, int offset, KmerCache *cache) const {
+	if (cache != nullptr) {
+		map<int, size_t>::const_iterator cached = cache->costs.find(cache->start + offset);
+		if (cached != cache->costs.end())
+			return cached->second;
+	}
+
+	string kmer = fragment.substr(offset, m_minSearchLength);
+	size_t cost = isIndexed(kmer) ? countSeeds(kmer, 0) : SIZE_MAX;
+	if (cache != nullptr)
+		cache->costs[cache->start + offset] = cost;
+	return cost;
+}
+
+//=================================================================================================
+//	const vector<SeqFrag>& exactPlaces
+//	returns the places the k-mer of fragment at offset is found in exactly. They are kept in cache
+//	for the windows after this one unless cache is nullptr, in which case uncached holds them
+//=================================================================================================
+const vector<GenomeMatcherImpl::SeqFrag>& GenomeMatcherImpl::exactPlaces(const string &fragment, int offset, KmerCache *cache, vector<SeqFrag> &uncached) const {
+	if (cache == nullptr) {
+		uncached = findSeeds(fragment.substr(offset, m_minSearchLength), 0);
+		return uncached;
+	}
+
+	map<int, vector<SeqFrag>>::iterator cached = cache->places.find(cache->start + offset);
+	if (cached == cache->places.end())
+		cached = cache->places.insert(make_pair(cache->start + offset, findSeeds(fragment.substr(offset, m_minSearchLength), 0))).first;
+	return cached->second;
+}
+
+//=================================================================================================
+//	bool collectMatches
+//	extends each candidate seed in candidates against fragment and adds the longest match of at
+//	least minimumLength per genome name to hits, the one in the earliest added genome and then at
+//	the earliest position if several are longest, whatever order candidates are in. Candidates
+//	from genomes not marked in allowed are skipped unless allowed is nullptr. Returns true if
+//	anything was added
+//=================================================================================================
+bool GenomeMatcherImpl::collectMatches(const string &fragment, int minimumLength, int maxMismatches, const vector<SeqFrag> &candidates, const vector<bool> *allowed, vector<Hit> &hits) const {
+	vector<Hit> matchHolder;
+
+	// adds any relevant matches to matchHolder
+	for (size_t i = 0; i < candidates.size(); i++) {
+		if (allowed != nullptr && !(*allowed)[candidates[i].genomeIndex])
+			continue;
+		Hit match = findMatch(fragment, candidates[i], maxMismatches);
+		int repl;
+		if (sameGenome(match, matchHolder, repl)) {
+			if (isBetter(match, matchHolder[repl]))
+				matchHolder[repl] = match;
+		}
+		else if(match.length >= minimumLength)
+			matchHolder.push_back(match);
+	}
+
+	// checks if anything was added to matchHolder and returns
+	hits.insert(hits.end(), matchHolder.begin(), matchHolder.end());
+	return !matchHolder.empty();
+}
+
+//=================================================================================================
+//	Hit findMatch
+//	finds the length of the given match, allowing up to maxMismatches SNiPs, and returns a Hit
+//	object of that match. Compares fragment with the genome's sequence in place, without copying
+//=================================================================================================
+GenomeMatcherImpl::Hit GenomeMatcherImpl::findMatch(const string &fragment, const SeqFrag &match, int maxMismatches) const {
+	// determine the fragment of the genome that should be checked
+	const string &sequence = m_genomeList[match.genomeIndex].sequence();
+	int glength = min((int)fragment.size(), (int)sequence.size() - match.position);
+
+	// create the Hit object
+	Hit m;
+	m.genomeName = &m_genomeList[match.genomeIndex].name();
+	m.genomeIndex = match.genomeIndex;
+	m.length = matchLength(fragment.data(), sequence.data() + match.position, max(glength, 0), maxMismatches);
+	m.position = match.position;
+	m.reverseStrand = false;
+	return m;
+}
+
+//=================================================================================================
+//	int matchLength
+//	returns how many of the first n chars of a and b match when up to maxMismatches differing chars
+//	are allowed, i.e. the index of the first mismatch past the budget (or n). Compares 64 chars
+//	per step, then 8, then one at a time. Each step gets a bit per differing char and spends the
+//	budget on all of them at once, so matching chars cost no branches at all
+//=================================================================================================
+int GenomeMatcherImpl::matchLength(const char *a, const char *b, int n, int maxMismatches) {
+	int i = 0;
+	for (; i + 64 <= n; i += 64) {
+		uint64_t differing = differingChars(a + i, b + i, 64);
+		if (differing != 0) {
+			int over = spendMismatches(differing, maxMismatches);
+			if (over >= 0)
+				return i + over;
+		}
+	}
+
+	for (; i + 8 <= n; i += 8) {
+		uint64_t differing = differingChars(a + i, b + i, 8);
+		if (differing != 0) {
+			int over = spendMismatches(differing, maxMismatches);
+			if (over >= 0)
+				return i + over;
+		}
+	}
+
+	for (; i < n; i++) {	// compare whatever is left one char at a time
+		if (a[i] != b[i]) {
+			if (maxMismatches == 0)
+				return i;
+			maxMismatches--;
+		}
+	}
+	return n;
+}
+
+//=================================================================================================
+//	uint64_t differingChars
+//	returns a mask with bit j set exactly where a[j] and b[j] differ, for the first count chars,
+//	where count is 64 or 8. With AVX2 or SSE2, 32 or 16 chars are compared per instruction and
+//	movemask gathers one bit per char. Otherwise eight chars are compared as one word: a byte of
+//	the xor of two words is nonzero exactly where the chars differ
+//=================================================================================================
+uint64_t GenomeMatcherImpl::differingChars(const char *a, const char *b, int count) {
+#if defined(GENOMEMATCHER_USE_AVX2)
+	if (count == 64) {
+		uint64_t equal = 0;
+		for (int j = 0; j < 64; j += 32) {
+			__m256i va = _mm256_loadu_si256((const __m256i *)(a + j));
+			__m256i vb = _mm256_loadu_si256((const __m256i *)(b + j));
+			equal |= (uint64_t)(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(va, vb)) << j;
+		}
+		return ~equal;
+	}
+#elif defined(GENOMEMATCHER_USE_SSE2)
+	if (count == 64) {
+		uint64_t equal = 0;
+		for (int j = 0; j < 64; j += 16) {
+			__m128i va = _mm_loadu_si128((const __m128i *)(a + j));
+			__m128i vb = _mm_loadu_si128((const __m128i *)(b + j));
+			equal |= (uint64_t)_mm_movemask_epi8(_mm_cmpeq_epi8(va, vb)) << j;
+		}
+		return ~equal;
+	}
+#endif
+	const uint64_t LOW7 = 0x7F7F7F7F7F7F7F7FULL;	// every bit but the top one of each byte
+	uint64_t differing = 0;
+	for (int j = 0; j < count; j += 8) {
+		uint64_t wa, wb;
+		memcpy(&wa, a + j, 8);
+		memcpy(&wb, b + j, 8);
+		uint64_t diff = wa ^ wb;
+		uint64_t tops = (((diff & LOW7) + LOW7) | diff) & ~LOW7;	// top bit set per differing byte
+		if (tops != 0)	// gathers byte k's top bit into bit j + k, assuming little-endian byte order
+			differing |= ((tops >> 7) * 0x0102040810204080ULL >> 56) << j;
+	}
+	return differing;
+}
+
+//=================================================================================================
+//	int spendMismatches
+//	spends the budget in maxMismatches on the differing chars marked in differing. If it covers
+//	them all, takes them out of the budget and returns -1. Otherwise returns the index of the
+//	first differing char past the budget
+//=================================================================================================
+int GenomeMatcherImpl::spendMismatches(uint64_t differing, int &maxMismatches) {
+	int count = countBits(differing);
+	if (count <= maxMismatches) {
+		maxMismatches -= count;
+		return -1;
+	}
+	for (; maxMismatches > 0; maxMismatches--)	// at most maxMismatches steps, not one per char
+		differing &= differing - 1;
+	return countTrailingZeros(differing);
+}
+
+//=================================================================================================
+//	int countTrailingZeros
+//	returns the index of the lowest set bit of bits, which must not be 0
+//=================================================================================================
+int GenomeMatcherImpl::countTrailingZeros(uint64_t bits) {
+#if defined(_MSC_VER) && defined(_WIN64)
+	unsigned long index;
+	_BitScanForward64(&index, bits);
+	return index;
+#elif defined(_MSC_VER)
+	unsigned long index;
+	if (_BitScanForward(&index, (unsigned long)bits))
+		return index;
+	_BitScanForward(&index, (unsigned long)(bits >> 32));
+	return index + 32;
+#else
+	return __builtin_ctzll(bits);
+#endif
+}
+
+//=================================================================================================
+//	int countBits
+//	returns the number of set bits in bits
+//=================================================================================================
+int GenomeMatcherImpl::countBits(uint64_t bits) {
+#if defined(_MSC_VER)
+	// __popcnt64 needs a POPCNT instruction that not every SSE2 processor has
+	bits = bits - ((bits >> 1) & 0x5555555555555555ULL);
+	bits = (bits & 0x3333333333333333ULL) + ((bits >> 2) & 0x3333333333333333ULL);
+	bits = (bits + (bits >> 4)) & 0x0F0F0F0F0F0F0F0FULL;
+	return (int)((bits * 0x0101010101010101ULL) >> 56);
+#else
+	return __builtin_popcountll(bits);
+#endif
+}
+
+//=================================================================================================
+//	bool sameGenome
+//	returns true if existingMatches already contains a Hit with the same name as newMatch and
+//	sets genomeInd to its index. Otherwise, returns false and leaves genomeInd unchanged.
+//=================================================================================================
+bool GenomeMatcherImpl::sameGenome(const Hit &newMatch, const vector<Hit> &existingMatches, int &genomeInd) const {
+	for (size_t i = 0; i < existingMatches.size(); i++) {
+		if (newMatch.genomeName == existingMatches[i].genomeName) {
+			genomeInd = i;
+			return true;
+		}
+	}
+	return false;
+}
+
+//=================================================================================================
+//	bool isBetter
+//	returns true if a should be reported instead of b, a match in a genome with the same name: it
+//	is longer, or as long and in an earlier added genome, or in the same genome at an earlier
+//	position
+//=================================================================================================
+bool GenomeMatcherImpl::isBetter(const Hit &a, const Hit &b) {
+	return a.length > b.length || (a.length == b.length && (a.genomeIndex < b.genomeIndex
+		|| (a.genomeIndex == b.genomeIndex && a.position < b.position)));
+}
+
+//=================================================================================================
+//	void addMatches
+//	appends a DNAMatch for each of hits to matches
+//=================================================================================================
+void GenomeMatcherImpl::addMatches(const vector<Hit> &hits, vector<DNAMatch> &matches) {
+	matches.reserve(matches.size() + hits.size());
+	for (size_t i = 0; i < hits.size(); i++) {
+		DNAMatch m;
+		m.genomeName = *hits[i].genomeName;
+		m.length = hits[i].length;
+		m.position = hits[i].position;
+		m.reverseStrand = hits[i].reverseStrand;
+		matches.push_back(m);
+	}
+}
+
+//=================================================================================================
+//	bool searchBothStrands
+//	does findGenomesWithMismatches for fragment and its reverse complement and adds the better
+//	match per genome name. The two are searched one after the other rather than as a batch: they
+//	seldom share a first char, so a batch would walk no trie paths together and only add its own
+//	overhead
+//=================================================================================================
+bool GenomeMatcherImpl::searchBothStrands(const string &fragment, int minimumLength, int maxMismatches, vector<DNAMatch> &matches) const {
+	string complement;
+	reverseComplement(fragment, complement);
+	vector<Hit> hits, reverse;
+	bool found = searchFragment(fragment, minimumLength, maxMismatches, nullptr, nullptr, hits);
+	if (searchFragment(complement, minimumLength, maxMismatches, nullptr, nullptr, reverse)) {
+		mergeStrands(reverse, hits);
+		found = true;
+	}
+	if (found)
+		addMatches(hits, matches);
+	return found;
+}
+
+//=================================================================================================
+//	void mergeStrands
+//	marks each of reverse, the hits of a fragment's reverse complement, as on the reverse strand
+//	and merges it into hits, the fragment's own: a genome name keeps the reverse hit only if it is
+//	longer, so the forward one wins a tie wherever the two start, and names only reverse matched
+//	are added after the others
+//=================================================================================================
+void GenomeMatcherImpl::mergeStrands(const vector<Hit> &reverse, vector<Hit> &hits) const {
+	for (size_t i = 0; i < reverse.size(); i++) {
+		Hit match = reverse[i];
+		match.reverseStrand = true;
+		int repl;
+		if (!sameGenome(match, hits, repl))
+			hits.push_back(match);
+		else if (match.length > hits[repl].length)
+			hits[repl] = match;
+	}
+}
+
+//=================================================================================================
+//	void reverseComplement
+//	sets complement to dna read backward with each base swapped for its pair (A and T, C and G).
+//	N stays N
+//=================================================================================================
+void GenomeMatcherImpl::reverseComplement(const string &dna, string &complement) {
+	complement.resize(dna.size());
+	for (size_t i = 0; i < dna.size(); i++) {
+		char base = dna[dna.size() - 1 - i];
+		switch (base) {
+		case 'A': base = 'T'; break;
+		case 'T': base = 'A'; break;
+		case 'C': base = 'G'; break;
+		case 'G': base = 'C'; break;
+		}
+		complement[i] = base;
+	}
+}
+
+//=================================================================================================
+//	void insertMatch
+//	inserts match into allMatches to maintain descending order of percentMatches
+//=================================================================================================
+void GenomeMatcherImpl::insertMatch(const GenomeMatch &match, vector<GenomeMatch> &allMatches) const {
+	vector<GenomeMatch>::iterator it;
+	for (it = allMatches.begin(); it != allMatches.end(); it++) {
+		if (match.percentMatch > it->percentMatch || match.percentMatch == it->percentMatch && match.genomeName < it->genomeName)
+			break;
+	}
+	allMatches.insert(it, match);
+}
+
+//=================================================================================================
+//	void buildSketch
+//	sets sketch to the sorted, distinct hashes of the SKETCH_KMER_LENGTH-mers of sequence that fall
+//	in the lowest 1/scale of the hash range. K-mers containing an N are skipped. Two sketches built
+//	this way share a hash exactly when both sequences contain that k-mer, so the shared fraction of
+//	the query's sketch estimates how much of the query a genome contains
+//=================================================================================================
+void GenomeMatcherImpl::buildSketch(const string &sequence, int scale, vector<uint64_t> &sketch) {
+	const uint64_t maxHash = UINT64_MAX / scale;
+	const uint64_t kmerMask = (1ULL << (2 * SKETCH_KMER_LENGTH)) - 1;
+	uint64_t code = 0;	// last SKETCH_KMER_LENGTH bases packed two bits each
+	int valid = 0;	// number of bases since the last N
+
+	sketch.clear();
+	for (size_t i = 0; i < sequence.size(); i++) {
+		int base;
+		switch (sequence[i]) {
+		case 'A': base = 0; break;
+		case 'C': base = 1; break;
+		case 'G': base = 2; break;
+		case 'T': base = 3; break;
+		default: base = -1; break;
+		}
+		if (base < 0) {	// restart the window after an N
+			valid = 0;
+			continue;
+		}
+		code = ((code << 2) | base) & kmerMask;
+		if (++valid >= SKETCH_KMER_LENGTH) {
+			uint64_t hash = hashKmer(code);
+			if (hash <= maxHash)
+				sketch.push_back(hash);
+		}
+	}
+
+	sort(sketch.begin(), sketch.end());
+	sketch.erase(unique(sketch.begin(), sketch.end()), sketch.end());
+}
+
+//=================================================================================================
+//	uint64_t hashKmer
+//	returns a well mixed 64 bit hash of a packed k-mer (the MurmurHash3 finalizer)
+//=================================================================================================
+uint64_t GenomeMatcherImpl::hashKmer(uint64_t code) {
+	code ^= code >> 33;
+	code *= 0xFF51AFD7ED558CCDULL;
+	code ^= code >> 33;
+	code *= 0xC4CEB9FE1A85EC53ULL;
+	code ^= code >> 33;
+	return code;
+}
+
+//=================================================================================================
+//	void hashKmers
+//	sets hashes to the hash of each k-mer of dna, in order. Rolls a polynomial hash of the chars
+//	along dna, adding the char entering the window and taking away the one leaving it, so every
+//	k-mer costs the same whatever kmerLength is, then mixes it with hashKmer. Unlike the packed
+//	codes of buildSketch it has no length limit, and Ns are hashed like any other char
+//=================================================================================================
+void GenomeMatcherImpl::hashKmers(const string &dna, int kmerLength, vector<uint64_t> &hashes) {
+	const uint64_t base = 0x100000001B3ULL;
+	uint64_t leaving = 1;	// base to the power kmerLength, what the char leaving the window was multiplied by
+	for (int i = 0; i < kmerLength; i++)
+		leaving *= base;
+
+	hashes.clear();
+	uint64_t rolling = 0;
+	for (size_t i = 0; i < dna.size(); i++) {
+		rolling = rolling * base + (unsigned char)dna[i];
+		if (i >= (size_t)kmerLength)
+			rolling -= leaving * (unsigned char)dna[i - kmerLength];
+		if (i + 1 >= (size_t)kmerLength)
+			hashes.push_back(hashKmer(rolling));
+	}
+}
+
+//=================================================================================================
+//	int sharedHashes
+//	returns the number of hashes that appear in both of the sorted sketches a and b
+//=================================================================================================
+int GenomeMatcherImpl::sharedHashes(const vector<uint64_t> &a, const vector<uint64_t> &b) {
+	int count = 0;
+	size_t i = 0, j = 0;
+	while (i < a.size() && j < b.size()) {
+		if (a[i] < b[j])
+			i++;
+		else if (b[j] < a[i])
+			j++;
+		else {
+			count++;
+			i++;
+			j++;
+		}
+	}
+	return count;
+}
+
+//=================================================================================================
+//	FrozenIndex constructor
+//	moves every posting list out of trie and encodes it, then freezes the k-mer tree into flat
+//	arrays
+//=================================================================================================
+GenomeMatcherImpl::FrozenIndex::FrozenIndex(Trie<SeqFrag, DnaAlphabet> &trie) {
+	trie.drain([this](const string &kmer, vector<SeqFrag> &list) {
+		List packed = { m_bytes.size(), list.size() };
+		m_lists.insert(kmer, packed);
+		encode(list);
+	});
+	m_bytes.resize(m_bytes.size() + 8, 0);	// so decode may always load 8 bytes at once
+	m_bytes.shrink_to_fit();
+	m_lists.freeze();
+}
+
+//=================================================================================================
+//	vector<SeqFrag> find
+//	returns the places of every k-mer within maxMismatches SNiPs of kmer, in the same order as
+//	Trie::findWithMismatches on the live index
+//=================================================================================================
+vector<GenomeMatcherImpl::SeqFrag> GenomeMatcherImpl::FrozenIndex::find(const string &kmer, int maxMismatches) const {
+	vector<List> lists = m_lists.findWithMismatches(kmer, maxMismatches);
+	vector<SeqFrag> seeds;
+	for (size_t i = 0; i < lists.size(); i++)
+		decode(lists[i], seeds);
+	return seeds;
+}
+
+//=================================================================================================
+//	void findBatch
+//	sets seeds[i] to find(kmers[i], maxMismatches), walking the shared paths of the k-mers once
+//=================================================================================================
+void GenomeMatcherImpl::FrozenIndex::findBatch(const vector<string> &kmers, int maxMismatches, vector<vector<SeqFrag>> &seeds) const {
+	vector<vector<List>> lists;
+	m_lists.findBatchWithMismatches(kmers, maxMismatches, lists);
+	seeds.assign(kmers.size(), vector<SeqFrag>());
+	for (size_t i = 0; i < lists.size(); i++) {
+		for (size_t j = 0; j < lists[i].size(); j++)
+			decode(lists[i][j], seeds[i]);
+	}
+}
+
+//=================================================================================================
+//	size_t count
+//	returns how many places find would return, without unpacking the lists
+//=================================================================================================
+size_t GenomeMatcherImpl::FrozenIndex::count(const string &kmer, int maxMismatches) const {
+	vector<List> lists = m_lists.findWithMismatches(kmer, maxMismatches);
+	size_t total = 0;
+	for (size_t i = 0; i < lists.size(); i++)
+		total += lists[i].size;
+	return total;
+}
+
+//=================================================================================================
+//	void thaw
+//	moves every posting list back into trie, in the order the lists were in when frozen. Leaves
+//	this index empty
+//=================================================================================================
+void GenomeMatcherImpl::FrozenIndex::thaw(Trie<SeqFrag, DnaAlphabet> &trie) {
+	vector<SeqFrag> list;
+	m_lists.drain([this, &trie, &list](const string &kmer, vector<List> &packed) {
+		list.clear();
+		decode(packed[0], list);
+		for (size_t i = 0; i < list.size(); i++)
+			trie.insert(kmer, list[i]);
+	});
+}
+
+//=================================================================================================
+//	void encode
+//	appends list, which must be sorted by genome and position, to m_bytes. Each block holds how
+//	far each place's genome is past the one before, then each place's position: as its distance
+//	from the position before if the genome is the same, otherwise in full
+//=================================================================================================
+void GenomeMatcherImpl::FrozenIndex::encode(const vector<SeqFrag> &list) {
+	uint32_t genomeSteps[BLOCK_SIZE];
+	uint32_t positions[BLOCK_SIZE];
+	SeqFrag previous = { 0, 0 };
+	for (size_t first = 0; first < list.size(); first += BLOCK_SIZE) {
+		int count = (int)min(list.size() - first, (size_t)BLOCK_SIZE);
+		for (int i = 0; i < count; i++) {
+			const SeqFrag &sf = list[first + i];
+			genomeSteps[i] = sf.genomeIndex - previous.genomeIndex;
+			positions[i] = genomeSteps[i] == 0 ? sf.position - previous.position : sf.position;
+			previous = sf;
+		}
+		pack(genomeSteps, count);
+		pack(positions, count);
+	}
+}
+
+//=================================================================================================
+//	void decode
+//	appends the places in packed to list
+//=================================================================================================
+void GenomeMatcherImpl::FrozenIndex::decode(const List &packed, vector<SeqFrag> &list) const {
+	const unsigned char *p = &m_bytes[packed.start];
+	size_t remaining = packed.size;
+	size_t next = list.size();	// where the next place goes in list
+	list.resize(next + remaining);
+
+	uint32_t genomeSteps[BLOCK_SIZE];
+	uint32_t positions[BLOCK_SIZE];
+	SeqFrag sf = { 0, 0 };
+	while (remaining > 0) {
+		int count = (int)min(remaining, (size_t)BLOCK_SIZE);
+		p = unpack(p, count, genomeSteps);
+		p = unpack(p, count, positions);
+		for (int i = 0; i < count; i++) {	// a select rather than a branch, as genome changes are unpredictable
+			sf.genomeIndex += genomeSteps[i];
+			sf.position = (genomeSteps[i] == 0 ? sf.position : 0) + positions[i];
+			list[next++] = sf;
+		}
+		remaining -= count;
+	}
+}
+
+//=================================================================================================
+//	void pack
+//	appends the count values to m_bytes as one byte giving the number of bits the largest needs,
+//	then each value in that many bits, value i in bits i * width to (i + 1) * width - 1
+//=================================================================================================
+void GenomeMatcherImpl::FrozenIndex::pack(const uint32_t *values, int count) {
+	uint32_t widest = 0;
+	for (int i = 0; i < count; i++)
+		widest |= values[i];
+	int width = 0;
+	while (width < 32 && widest >> width != 0)
+		width++;
+
+	m_bytes.push_back((unsigned char)width);
+	size_t block = m_bytes.size();
+	m_bytes.resize(block + (count * width + 7) / 8, 0);
+	for (int i = 0; i < count; i++) {
+		size_t bit = (size_t)i * width;
+		uint64_t shifted = (uint64_t)values[i] << (bit % 8);
+		for (size_t b = bit / 8; shifted != 0; b++, shifted >>= 8)
+			m_bytes[block + b] |= (unsigned char)(shifted & 0xFF);
+	}
+}
+
+//=================================================================================================
+//	const unsigned char* unpack
+//	sets values to the count values packed at p and returns where the packed values end. Every
+//	value is read with the same load, shift and mask, with no branches, so compilers can vectorize
+//	the loop. Relies on the padding at the end of m_bytes to load 8 bytes at a time
+//=================================================================================================
+const unsigned char* GenomeMatcherImpl::FrozenIndex::unpack(const unsigned char *p, int count, uint32_t *values) {
+	int width = *p++;
+	uint64_t mask = (1ULL << width) - 1;
+	for (int i = 0; i < count; i++) {
+		size_t bit = (size_t)i * width;
+		uint64_t word;
+		memcpy(&word, p + bit / 8, 8);	// assumes little-endian byte order, like pack
+		values[i] = (uint32_t)((word >> (bit % 8)) & mask);
+	}
+	return p + (count * width + 7) / 8;
+}
+
+// defined here too since setCapacity passes it to min, which takes it by reference
+const size_t ResultCache::MAX_SHARDS;
+
+//=================================================================================================
+//	ResultCache constructor
+//	starts with the cache off
+//=================================================================================================
+ResultCache::ResultCache()
+	: m_numShards(0)
+{
+	for (size_t i = 0; i < MAX_SHARDS; i++) {
+		m_shards[i].capacity = 0;
+		m_shards[i].hits = 0;
+		m_shards[i].misses = 0;
+	}
+}
+
+//=================================================================================================
+//	void setCapacity
+//	sets the most results the cache may hold and forgets the ones it holds, since keys may now
+//	belong to other shards. The capacity is shared out among min(capacity, MAX_SHARDS) shards. A
+//	capacity of 0 turns the cache off. Must not be called while a query may be using the cache
+//=================================================================================================
+void ResultCache::setCapacity(size_t capacity) {
+	clear();
+	size_t numShards = min(capacity, MAX_SHARDS);
+	for (size_t i = 0; i < MAX_SHARDS; i++)
+		m_shards[i].capacity = i < numShards ? capacity / numShards + (i < capacity % numShards ? 1 : 0) : 0;
+	m_numShards.store(numShards);
+}
+
+//=================================================================================================
+//	void clear
+//	forgets every result, keeping the capacity and the hit and miss counts
+//=================================================================================================
+void ResultCache::clear() {
+	for (size_t i = 0; i < MAX_SHARDS; i++) {
+		lock_guard<mutex> lock(m_shards[i].lock);
+		m_shards[i].entries.clear();
+		m_shards[i].index.clear();
+	}
+}
+
+//=================================================================================================
+//	bool find
+//	if the cache holds the result of this query, adds its matches to matches, sets found to what
+//	the query returned, marks it most recently used in its shard and returns true. Otherwise
+//	returns false
+//=================================================================================================
+bool ResultCache::find(const string &fragment, int minimumLength, bool exactMatchOnly, bool bothStrands, vector<DNAMatch> &matches, bool &found) {
+	if (!enabled())
+		return false;
+
+	Key key = { fragment, minimumLength, exactMatchOnly, bothStrands };
+	Shard &shard = shardFor(key);
+	lock_guard<mutex> lock(shard.lock);
+	unordered_map<Key, list<Entry>::iterator, KeyHash>::iterator it = shard.index.find(key);
+	if (it == shard.index.end()) {
+		shard.misses++;
+		return false;
+	}
+	shard.hits++;
+	shard.entries.splice(shard.entries.begin(), shard.entries, it->second);
+	matches.insert(matches.end(), it->second->matches.begin(), it->second->matches.end());
+	found = it->second->found;
+	return true;
+}
+
+//=================================================================================================
+//	void store
+//	remembers matches and found as the result of this query, dropping the least recently used
+//	result of its shard if the shard is full
+//=================================================================================================
+void ResultCache::store(const string &fragment, int minimumLength, bool exactMatchOnly, bool bothStrands, const vector<DNAMatch> &matches, bool found) {
+	if (!enabled())
+		return;
+
+	Entry entry = { { fragment, minimumLength, exactMatchOnly, bothStrands }, matches, found };
+	Shard &shard = shardFor(entry.key);
+	lock_guard<mutex> lock(shard.lock);
+	unordered_map<Key, list<Entry>::iterator, KeyHash>::iterator it = shard.index.find(entry.key);
+	if (it != shard.index.end()) {	// another thread stored it first
+		shard.entries.splice(shard.entries.begin(), shard.entries, it->second);
+		return;
+	}
+	if (shard.entries.size() == shard.capacity) {
+		shard.index.erase(shard.entries.back().key);
+		shard.entries.pop_back();
+	}
+	shard.entries.push_front(entry);
+	shard.index[entry.key] = shard.entries.begin();
+}
+
+//=================================================================================================
+//	long long hits / misses
+//	return the lookups that did and did not find a result, summed over the shards
+//=================================================================================================
+long long ResultCache::hits() const {
+	long long total = 0;
+	for (size_t i = 0; i < MAX_SHARDS; i++)
+		total += m_shards[i].hits.load();
+	return total;
+}
+
+long long ResultCache::misses() const {
+	long long total = 0;
+	for (size_t i = 0; i < MAX_SHARDS; i++)
+		total += m_shards[i].misses.load();
+	return total;
+}
+
+//=================================================================================================
+//	KmerFilter constructors
+//	the default filter is empty. The other sizes the filter at BITS_PER_KMER bits for each of
+//	hashes and adds them all
+//=================================================================================================
+KmerFilter::KmerFilter()
+	: m_numBlocks(0) {}
+
+KmerFilter::KmerFilter(const vector<uint64_t> &hashes)
+	: m_numBlocks(0)
+{
+	m_numBlocks = max<uint64_t>(1, (hashes.size() * BITS_PER_KMER + 64 * BLOCK_WORDS - 1) / (64 * BLOCK_WORDS));
+	m_words.assign(m_numBlocks * BLOCK_WORDS, 0);
+	for (size_t i = 0; i < hashes.size(); i++) {
+		uint64_t *block = &m_words[blockStart(hashes[i])];
+		for (int w = 0; w < BLOCK_WORDS; w++)
+			block[w] |= bitInWord(hashes[i], w);
+	}
+}
+
+//=================================================================================================
+//	bool empty
+//	returns true if no k-mer was added, so that the filter says every k-mer is there
+//=================================================================================================
+bool KmerFilter::empty() const {
+	return m_numBlocks == 0;
+}
+
+//=================================================================================================
+//	bool mayContain
+//	returns false if the k-mer with this hash was never added, true if it was or might have been
+//=================================================================================================
+bool KmerFilter::mayContain(uint64_t hash) const {
+	if (m_numBlocks == 0)
+		return true;
+	const uint64_t *block = &m_words[blockStart(hash)];
+	for (int w = 0; w < BLOCK_WORDS; w++) {
+		if ((block[w] & bitInWord(hash, w)) == 0)
+			return false;
+	}
+	return true;
+}
+
+//=================================================================================================
+//	size_t blockStart
+//	returns where the block that hash's top 32 bits pick starts in m_words
+//=================================================================================================
+size_t KmerFilter::blockStart(uint64_t hash) const {
+	return (size_t)(((hash >> 32) * m_numBlocks) >> 32) * BLOCK_WORDS;
+}
+
+//=================================================================================================
+//	uint64_t bitInWord
+//	returns the bit hash sets in word of its block, picked from the hash's low 32 bits by a
+//	different odd multiplier for each word
+//=================================================================================================
+uint64_t KmerFilter::bitInWord(uint64_t hash, int word) {
+	static const uint32_t salts[BLOCK_WORDS] = {
+		0x47B6137BU, 0x44974D91U, 0x8824AD5BU, 0xA2B7289DU, 0x705495C7U, 0x2DF1424BU, 0x9EFC4947U, 0x5C6BFB31U
+	};
+	return 1ULL << (((uint32_t)hash * salts[word]) >> 26);
+}
+
+//=================================================================================================
+//	class ConcurrentGenomeMatcherImpl
+//	a GenomeMatcherImpl that any number of threads may query while one thread adds genomes. It
+//	keeps two identical replicas (the left-right technique): queries read the replica that
+//	m_current names, and addGenome adds the genome to the other replica, publishes it by switching
+//	m_current, waits for the queries still reading the old replica to finish, then adds the genome
+//	to the old replica too. Every query therefore sees a snapshot that no thread is changing, and
+//	queries never wait for a lock: entering a replica costs two atomic increments. The replicas'
+//	genomes share their sequences, so the extra memory is mostly the second trie
+//=================================================================================================
+class ConcurrentGenomeMatcherImpl
+{
+public:
+	ConcurrentGenomeMatcherImpl(int minSearchLength, int sketchScale);
+	GenomeMatcherImpl* createEmptyCopy() const;
+	void addGenome(const Genome& genome);
+	void addGenomesFrom(GenomeMatcherImpl& other);
+	vector<Genome> genomes() const;
+	void clear();
+	int minimumSearchLength() const;
+	bool findGenomesWithThisDNA(const string& fragment, int minimumLength, bool exactMatchOnly, vector<DNAMatch>& matches, bool bothStrands) const;
+	bool findGenomesWithMismatches(const string& fragment, int minimumLength, int maxMismatches, vector<DNAMatch>& matches) const;
+	bool findGenomesWithMismatchesBatch(const vector<string>& fragments, int minimumLength, int maxMismatches, vector<vector<DNAMatch>>& matches) const;
+	bool findRelatedGenomes(const Genome& query, int fragmentMatchLength, bool exactMatchOnly, double matchPercentThreshold, vector<GenomeMatch>& results, bool bothStrands) const;
+	bool findRelatedGenomesSketch(const Genome& query, int fragmentMatchLength, bool exactMatchOnly, double matchPercentThreshold, int verifyTop, vector<GenomeMatch>& results) const;
+	bool findRelatedPercentages(const Genome& query, int fragmentMatchLength, bool exactMatchOnly, vector<double>& percents, bool bothStrands) const;
+	void setResultCacheCapacity(int capacity);
+	long long resultCacheHits() const;
+	long long resultCacheMisses() const;
+	void setMaxIndexedNs(int maxNs);
+	void setMaxSeedOccurrences(int maxOccurrences);
+	void setFragmentStride(int stride);
+	void setRelatedPrefilter(int sampleFragments);
+	void freezeIndex();
+private:
+	class ReadGuard;
+	struct ReaderCount {	// padded to its own cache line so the two counts don't contend
+		atomic<long> count;
+		char padding[64 - sizeof(atomic<long>)];
+	};
+	unique_ptr<GenomeMatcherImpl> m_replicas[2];
+	atomic<int> m_current;	// index of the replica new queries read
+	mutable ReaderCount m_readers[2];	// number of queries reading each replica
+	mutex m_writeMutex;	// held by every change, so writers take turns
+
+	template<typename Change> void applyToReplicas(Change change);
+};
+
+//=================================================================================================
+//	class ReadGuard
+//	registers a query as a reader of the current replica for as long as the guard lives
+//=================================================================================================
+class ConcurrentGenomeMatcherImpl::ReadGuard
+{
+public:
+	ReadGuard(const ConcurrentGenomeMatcherImpl &matcher);
+	~ReadGuard() { m_matcher.m_readers[m_index].count.fetch_sub(1); }
+	const GenomeMatcherImpl& replica() const { return *m_matcher.m_replicas[m_index]; }
+
+	ReadGuard(const ReadGuard&) = delete;
+	ReadGuard& operator=(const ReadGuard&) = delete;
+private:
+	const ConcurrentGenomeMatcherImpl &m_matcher;
+	int m_index;
+};
+
+//=================================================================================================
+//	ReadGuard constructor
+//	counts this query as a reader of the current replica. If addGenome switched replicas before
+//	the count was visible, the writer may already be changing that replica, so tries again
+//=================================================================================================
+ConcurrentGenomeMatcherImpl::ReadGuard::ReadGuard(const ConcurrentGenomeMatcherImpl &matcher)
+	: m_matcher(matcher)
+{
+	for (;;) {
+		m_index = m_matcher.m_current.load();
+		m_matcher.m_readers[m_index].count.fetch_add(1);
+		if (m_matcher.m_current.load() == m_index)
+			return;
+		m_matcher.m_readers[m_index].count.fetch_sub(1);
+	}
+}
+
+//=================================================================================================
+//	constructor
+//	creates two empty replicas and points queries at the first
+//=================================================================================================
+ConcurrentGenomeMatcherImpl::ConcurrentGenomeMatcherImpl(int minSearchLength, int sketchScale)
+	: m_current(0)
+{
+	for (int i = 0; i < 2; i++) {
+		m_replicas[i].reset(new GenomeMatcherImpl(minSearchLength, sketchScale));
+		m_readers[i].count = 0;
+	}
+}
+
+//=================================================================================================
+//	void addGenome
+//	adds genome to both replicas with applyToReplicas
+//=================================================================================================
+void ConcurrentGenomeMatcherImpl::addGenome(const Genome& genome)
+{
+	applyToReplicas([&genome](GenomeMatcherImpl &replica) { replica.addGenome(genome); });
+}
+
+//=================================================================================================
+//	void addGenomesFrom
+//	adds other's genomes to both replicas with applyToReplicas. The first replica gets copies, so
+//	that other still has its genomes for the second, which takes them over with addGenomesFrom
+//=================================================================================================
+void ConcurrentGenomeMatcherImpl::addGenomesFrom(GenomeMatcherImpl& other)
+{
+	bool first = true;
+	applyToReplicas([&other, &first](GenomeMatcherImpl &replica) {
+		if (first)
+			replica.addCopiesFrom(other);
+		else
+			replica.addGenomesFrom(other);
+		first = false;
+	});
+}
+
+//=================================================================================================
+//	GenomeMatcherImpl* createEmptyCopy
+//	returns the current replica's createEmptyCopy, made while reading it like any query, which is
+//	never concurrent
+//=================================================================================================
+GenomeMatcherImpl* ConcurrentGenomeMatcherImpl::createEmptyCopy() const
+{
+	ReadGuard guard(*this);
+	return guard.replica().createEmptyCopy();
+}
+
+//=================================================================================================
+//	vector<Genome> genomes
+//	returns a copy of the current replica's genomes, taken while reading it like any query
+//=================================================================================================
+vector<Genome> ConcurrentGenomeMatcherImpl::genomes() const
+{
+	ReadGuard guard(*this);
+	return guard.replica().genomes();
+}
+
+//=================================================================================================
+//	void clear
+//	empties both replicas with applyToReplicas
+//=================================================================================================
+void ConcurrentGenomeMatcherImpl::clear()
+{
+	applyToReplicas([](GenomeMatcherImpl &replica) { replica.clear(); });
+}
+
+//=================================================================================================
+//	void freezeIndex
+//	freezes both replicas' indexes with applyToReplicas
+//=================================================================================================
+void ConcurrentGenomeMatcherImpl::freezeIndex()
+{
+	applyToReplicas([](GenomeMatcherImpl &replica) { replica.freezeIndex(); });
+}
+
+//=================================================================================================
+//	void applyToReplicas
+//	calls change on the replica no query is reading, makes it the current replica, and calls
+//	change on the other replica once its last reader is gone
+//=================================================================================================
+template<typename Change>
+void ConcurrentGenomeMatcherImpl::applyToReplicas(Change change)
+{
+	lock_guard<mutex> lock(m_writeMutex);
+	int standby = 1 - m_current.load();
+	change(*m_replicas[standby]);
+	m_current.store(standby);
+	while (m_readers[1 - standby].count.load() != 0)
+		this_thread::yield();
+	change(*m_replicas[1 - standby]);
+}
+
+//=================================================================================================
+//	query functions
+//	each runs the GenomeMatcherImpl query on the current replica
+//=================================================================================================
+int ConcurrentGenomeMatcherImpl::minimumSearchLength() const
+{
+	return m_replicas[0]->minimumSearchLength();	// never changes, so needs no guard
+}
+
+bool ConcurrentGenomeMatcherImpl::findGenomesWithThisDNA(const string& fragment, int minimumLength, bool exactMatchOnly, vector<DNAMatch>& matches, bool bothStrands) const
+{
+	ReadGuard guard(*this);
+	return guard.replica().findGenomesWithThisDNA(fragment, minimumLength, exactMatchOnly, matches, bothStrands);
+}
+
+bool ConcurrentGenomeMatcherImpl::findGenomesWithMismatches(const string& fragment, int minimumLength, int maxMismatches, vector<DNAMatch>& matches) const
+{
+	ReadGuard guard(*this);
+	return guard.replica().findGenomesWithMismatches(fragment, minimumLength, maxMismatches, matches);
+}
+
+bool ConcurrentGenomeMatcherImpl::findGenomesWithMismatchesBatch(const vector<string>& fragments, int minimumLength, int maxMismatches, vector<vector<DNAMatch>>& matches) const
+{
+	ReadGuard guard(*this);
+	return guard.replica().findGenomesWithMismatchesBatch(fragments, minimumLength, maxMismatches, matches);
+}
+
+bool ConcurrentGenomeMatcherImpl::findRelatedGenomes(const Genome& query, int fragmentMatchLength, bool exactMatchOnly, double matchPercentThreshold, vector<GenomeMatch>& results, bool bothStrands) const
+{
+	ReadGuard guard(*this);
+	return guard.replica().findRelatedGenomes(query, fragmentMatchLength, exactMatchOnly, matchPercentThreshold, results, bothStrands);
+}
+
+bool ConcurrentGenomeMatcherImpl::findRelatedGenomesSketch(const Genome& query, int fragmentMatchLength, bool exactMatchOnly, double matchPercentThreshold, int verifyTop, vector<GenomeMatch>& results) const
+{
+	ReadGuard guard(*this);
+	return guard.replica().findRelatedGenomesSketch(query, fragmentMatchLength, exactMatchOnly, matchPercentThreshold, verifyTop, results);
+}
+
+bool ConcurrentGenomeMatcherImpl::findRelatedPercentages(const Genome& query, int fragmentMatchLength, bool exactMatchOnly, vector<double>& percents, bool bothStrands) const
+{
+	ReadGuard guard(*this);
+	return guard.replica().findRelatedPercentages(query, fragmentMatchLength, exactMatchOnly, percents, bothStrands);
+}
+
+//=================================================================================================
+//	result cache functions
+//	each replica caches the queries made while it is current, so the counts are the replicas' sums.
+//	The capacity is set with applyToReplicas, since queries use the cache
+//=================================================================================================
+void ConcurrentGenomeMatcherImpl::setResultCacheCapacity(int capacity)
+{
+	applyToReplicas([capacity](GenomeMatcherImpl &replica) { replica.setResultCacheCapacity(capacity); });
+}
+
+long long ConcurrentGenomeMatcherImpl::resultCacheHits() const
+{
+	return m_replicas[0]->resultCacheHits() + m_replicas[1]->resultCacheHits();
+}
+
+long long ConcurrentGenomeMatcherImpl::resultCacheMisses() const
+{
+	return m_replicas[0]->resultCacheMisses() + m_replicas[1]->resultCacheMisses();
+}
+
+//=================================================================================================
+//	void setMaxIndexedNs
+//	sets the option on both replicas with applyToReplicas, so it changes between queries like the
+//	other options do
+//=================================================================================================
+void ConcurrentGenomeMatcherImpl::setMaxIndexedNs(int maxNs)
+{
+	applyToReplicas([maxNs](GenomeMatcherImpl &replica) { replica.setMaxIndexedNs(maxNs); });
+}
+
+//=================================================================================================
+//	void setMaxSeedOccurrences
+//	sets the option on both replicas. Only addGenome reads it, so this just has to wait its turn
+//	with addGenome
+//=================================================================================================
+void ConcurrentGenomeMatcherImpl::setMaxSeedOccurrences(int maxOccurrences)
+{
+	lock_guard<mutex> lock(m_writeMutex);
+	for (int i = 0; i < 2; i++)
+		m_replicas[i]->setMaxSeedOccurrences(maxOccurrences);
+}
+
+//=================================================================================================
+//	void setFragmentStride
+//	sets the option on both replicas with applyToReplicas, since queries read it
+//=================================================================================================
+void ConcurrentGenomeMatcherImpl::setFragmentStride(int stride)
+{
+	applyToReplicas([stride](GenomeMatcherImpl &replica) { replica.setFragmentStride(stride); });
+}
+
+//=================================================================================================
+//	void setRelatedPrefilter
+//	sets the option on both replicas with applyToReplicas, since queries read it
+//=================================================================================================
+void ConcurrentGenomeMatcherImpl::setRelatedPrefilter(int sampleFragments)
+{
+	applyToReplicas([sampleFragments](GenomeMatcherImpl &replica) { replica.setRelatedPrefilter(sampleFragments); });
+}
+
+
+//******************** GenomeMatcher functions ********************************
+
+// These functions simply delegate to GenomeMatcherImpl's functions, or to
+// ConcurrentGenomeMatcherImpl's if the library was created for concurrent use.
+
+GenomeMatcher::GenomeMatcher(int minSearchLength, int sketchScale, bool concurrent)
+	: m_impl(nullptr), m_concurrentImpl(nullptr)
+{
+	if (concurrent)
+		m_concurrentImpl = new ConcurrentGenomeMatcherImpl(minSearchLength, sketchScale);
+	else
+		m_impl = new GenomeMatcherImpl(minSearchLength, sketchScale);
+}
+
+GenomeMatcher::GenomeMatcher(GenomeMatcherImpl* impl)
+	: m_impl(impl), m_concurrentImpl(nullptr)
+{
+}
+
+GenomeMatcher::~GenomeMatcher()
+{
+	delete m_impl;
+	delete m_concurrentImpl;
+}
+
+void GenomeMatcher::addGenome(const Genome& genome)
+{
+	if (m_concurrentImpl != nullptr)
+		m_concurrentImpl->addGenome(genome);
+	else
+		m_impl->addGenome(genome);
+}
+
+void GenomeMatcher::addGenomesFrom(GenomeMatcher& other)
+{
+	if (&other == this)
+		return;
+	if (m_impl != nullptr && other.m_impl != nullptr) {
+		m_impl->addGenomesFrom(*other.m_impl);
+		return;
+	}
+	if (other.m_impl != nullptr) {
+		m_concurrentImpl->addGenomesFrom(*other.m_impl);
+		return;
+	}
+	vector<Genome> genomes = other.genomes();
+	for (size_t i = 0; i < genomes.size(); i++)
+		addGenome(genomes[i]);
+	if (other.m_impl != nullptr)
+		other.m_impl->clear();
+	else
+		other.m_concurrentImpl->clear();
+}
+
+GenomeMatcher* GenomeMatcher::createEmptyCopy() const
+{
+	if (m_concurrentImpl != nullptr)
+		return new GenomeMatcher(m_concurrentImpl->createEmptyCopy());
+	return new GenomeMatcher(m_impl->createEmptyCopy());
+}
+
+int GenomeMatcher::minimumSearchLength() const
+{
+	if (m_concurrentImpl != nullptr)
+		return m_concurrentImpl->minimumSearchLength();
 	return m_impl->minimumSearchLength();
 }
 
-bool GenomeMatcher::findGenomesWithThisDNA(const string& fragment, int minimumLength, bool exactMatchOnly, vector<DNAMatch>& matches) const
+bool GenomeMatcher::findGenomesWithThisDNA(const string& fragment, int minimumLength, bool exactMatchOnly, vector<DNAMatch>& matches, bool bothStrands) const
+{
+	if (m_concurrentImpl != nullptr)
+		return m_concurrentImpl->findGenomesWithThisDNA(fragment, minimumLength, exactMatchOnly, matches, bothStrands);
+	return m_impl->findGenomesWithThisDNA(fragment, minimumLength, exactMatchOnly, matches, bothStrands);
+}
+
+bool GenomeMatcher::findGenomesWithMismatches(const string& fragment, int minimumLength, int maxMismatches, vector<DNAMatch>& matches) const
+{
+	if (m_concurrentImpl != nullptr)
+		return m_concurrentImpl->findGenomesWithMismatches(fragment, minimumLength, maxMismatches, matches);
+	return m_impl->findGenomesWithMismatches(fragment, minimumLength, maxMismatches, matches);
+}
+
+bool GenomeMatcher::findGenomesWithThisDNABatch(const vector<string>& fragments, int minimumLength, bool exactMatchOnly, vector<vector<DNAMatch>>& matches) const
+{
+	if (m_concurrentImpl != nullptr)
+		return m_concurrentImpl->findGenomesWithMismatchesBatch(fragments, minimumLength, exactMatchOnly ? 0 : 1, matches);
+	return m_impl->findGenomesWithMismatchesBatch(fragments, minimumLength, exactMatchOnly ? 0 : 1, matches);
+}
+
+bool GenomeMatcher::findGenomesWithMismatchesBatch(const vector<string>& fragments, int minimumLength, int maxMismatches, vector<vector<DNAMatch>>& matches) const
+{
+	if (m_concurrentImpl != nullptr)
+		return m_concurrentImpl->findGenomesWithMismatchesBatch(fragments, minimumLength, maxMismatches, matches);
+	return m_impl->findGenomesWithMismatchesBatch(fragments, minimumLength, maxMismatches, matches);
+}
+
+bool GenomeMatcher::findRelatedGenomes(const Genome& query, int fragmentMatchLength, bool exactMatchOnly, double matchPercentThreshold, vector<GenomeMatch>& results, bool bothStrands) const
+{
+	if (m_concurrentImpl != nullptr)
+		return m_concurrentImpl->findRelatedGenomes(query, fragmentMatchLength, exactMatchOnly, matchPercentThreshold, results, bothStrands);
+	return m_impl->findRelatedGenomes(query, fragmentMatchLength, exactMatchOnly, matchPercentThreshold, results, bothStrands);
+}
+
+bool GenomeMatcher::findRelatedGenomesSketch(const Genome& query, int fragmentMatchLength, bool exactMatchOnly, double matchPercentThreshold, int verifyTop, vector<GenomeMatch>& results) const
+{
+	if (m_concurrentImpl != nullptr)
+		return m_concurrentImpl->findRelatedGenomesSketch(query, fragmentMatchLength, exactMatchOnly, matchPercentThreshold, verifyTop, results);
+	return m_impl->findRelatedGenomesSketch(query, fragmentMatchLength, exactMatchOnly, matchPercentThreshold, verifyTop, results);
+}
+
+bool GenomeMatcher::findRelatedPercentages(const Genome& query, int fragmentMatchLength, bool exactMatchOnly, vector<double>& percents, bool bothStrands) const
+{
+	if (m_concurrentImpl != nullptr)
+		return m_concurrentImpl->findRelatedPercentages(query, fragmentMatchLength, exactMatchOnly, percents, bothStrands);
+	return m_impl->findRelatedPercentages(query, fragmentMatchLength, exactMatchOnly, percents, bothStrands);
+}
+
+vector<Genome> GenomeMatcher::genomes() const
+{
+	if (m_concurrentImpl != nullptr)
+		return m_concurrentImpl->genomes();
+	return m_impl->genomes();
+}
+
+void GenomeMatcher::setResultCacheCapacity(int capacity)
+{
+	if (m_concurrentImpl != nullptr)
+		m_concurrentImpl->setResultCacheCapacity(capacity);
+	else
+		m_impl->setResultCacheCapacity(capacity);
+}
+
+long long GenomeMatcher::resultCacheHits() const
+{
+	if (m_concurrentImpl != nullptr)
+		return m_concurrentImpl->resultCacheHits();
+	return m_impl->resultCacheHits();
+}
+
+long long GenomeMatcher::resultCacheMisses() const
+{
+	if (m_concurrentImpl != nullptr)
+		return m_concurrentImpl->resultCacheMisses();
+	return m_impl->resultCacheMisses();
+}
+
+void GenomeMatcher::setMaxIndexedNs(int maxNs)
+{
+	if (m_concurrentImpl != nullptr)
+		m_concurrentImpl->setMaxIndexedNs(maxNs);
+	else
+		m_impl->setMaxIndexedNs(maxNs);
+}
+
+void GenomeMatcher::setMaxSeedOccurrences(int maxOccurrences)
+{
+	if (m_concurrentImpl != nullptr)
+		m_concurrentImpl->setMaxSeedOccurrences(maxOccurrences);
+	else
+		m_impl->setMaxSeedOccurrences(maxOccurrences);
+}
+
+void GenomeMatcher::setFragmentStride(int stride)
+{
+	if (m_concurrentImpl != nullptr)
+		m_concurrentImpl->setFragmentStride(stride);
+	else
+		m_impl->setFragmentStride(stride);
+}
+
+void GenomeMatcher::setRelatedPrefilter(int sampleFragments)
 {
-	return m_impl->findGenomesWithThisDNA(fragment, minimumLength, exactMatchOnly, matches);
+	if (m_concurrentImpl != nullptr)
+		m_concurrentImpl->setRelatedPrefilter(sampleFragments);
+	else
+		m_impl->setRelatedPrefilter(sampleFragments);
 }
 
-bool GenomeMatcher::findRelatedGenomes(const Genome& query, int fragmentMatchLength, bool exactMatchOnly, double matchPercentThreshold, vector<GenomeMatch>& results) const
+void GenomeMatcher::freezeIndex()
 {
-	return m_impl->findRelatedGenomes(query, fragmentMatchLength, exactMatchOnly, matchPercentThreshold, results);
+	if (m_concurrentImpl != nullptr)
+		m_concurrentImpl->freezeIndex();
+	else
+		m_impl->freezeIndex();
 }
@@ -0,0 +1,323 @@
+#ifndef RADIXTRIE_INCLUDED
+#define RADIXTRIE_INCLUDED
+
+#include <string>
+#include <vector>
+
+//=================================================================================================
+//	class RadixTrie
+//	a Trie whose chains of single-child nodes are merged into one node, labelled with all of the
+//	chain's chars. Maps keys to values exactly as Trie does, and finds them in the same order, but
+//	needs one node per branch or key end instead of one per char. A node is split in two when a
+//	new key leaves or ends partway along its label
+//=================================================================================================
+template<typename ValueType>
+class RadixTrie
+{
+public:
+	RadixTrie();
+	~RadixTrie();
+	void reset();
+	size_t insert(const std::string &key, const ValueType &value);
+	void removeValues(const std::string &key);
+	std::vector<ValueType> find(const std::string &key, bool exactMatchOnly) const;
+	std::vector<ValueType> findWithMismatches(const std::string &key, int maxMismatches) const;
+	size_t countWithMismatches(const std::string &key, int maxMismatches) const;
+	size_t nodeCount() const;
+
+	  // C++11 syntax for preventing copying and assignment
+	RadixTrie(const RadixTrie&) = delete;
+	RadixTrie& operator=(const RadixTrie&) = delete;
+private:
+	struct Node;
+	Node *m_root;	// its label is always empty
+
+		// called by destructor and reset
+	void deleteNode(Node *root);
+
+		// called by insert and removeValues
+	Node* findChild(const Node *root, const char first) const;
+	size_t sharedLength(const std::string &label, const std::string &key, size_t depth) const;
+
+		// called by find
+	void findNode(const Node *root, const std::string &key, size_t depth, int mismatchesLeft, std::vector<ValueType> &vals) const;
+
+		// called by countWithMismatches
+	size_t countNode(const Node *root, const std::string &key, size_t depth, int mismatchesLeft) const;
+
+		// called by findNode and countNode
+	bool matchLabel(const Node *root, const std::string &key, size_t depth, int &mismatchesLeft) const;
+
+		// called by nodeCount
+	size_t nodesBelow(const Node *root) const;
+};
+
+//=================================================================================================
+//	PUBLIC MEMBERS
+//=================================================================================================
+
+//=================================================================================================
+//	constructor
+//	dynamically allocates the root node with m_root
+//=================================================================================================
+template<typename ValueType>
+RadixTrie<ValueType>::RadixTrie() {
+	m_root = new Node;
+}
+
+//=================================================================================================
+//	destructor
+//	deletes each node in the tree using deleteNode
+//=================================================================================================
+template<typename ValueType>
+RadixTrie<ValueType>::~RadixTrie() {
+	deleteNode(m_root);
+}
+
+//=================================================================================================
+//	void reset
+//	deletes the entire tree and creates a new root node
+//=================================================================================================
+template<typename ValueType>
+void RadixTrie<ValueType>::reset() {
+	deleteNode(m_root);
+	m_root = new Node;
+}
+
+//=================================================================================================
+//	size_t insert
+//	maps value to key and returns how many values key now maps to. Follows key down the labels,
+//	splitting the node where key leaves or ends within a label, and hangs whatever is left of key
+//	off the last node as one new node
+//=================================================================================================
+template<typename ValueType>
+size_t RadixTrie<ValueType>::insert(const std::string &key, const ValueType &value) {
+	Node *cur = m_root;	// the current node being analyzed
+	size_t depth = 0;	// how much of key cur's labels cover
+
+	while (depth < key.size()) {
+		Node *child = findChild(cur, key[depth]);
+		if (child == nullptr) {	// nothing shares the rest of key so it becomes one new node
+			child = new Node;
+			child->label = key.substr(depth);
+			cur->childs.push_back(child);
+			cur = child;
+			break;
+		}
+
+		size_t shared = sharedLength(child->label, key, depth);
+		if (shared < child->label.size()) {	// key leaves or ends within child's label so split
+											// child, keeping its place among cur's children
+			Node *head = new Node;
+			head->label = child->label.substr(0, shared);
+			child->label.erase(0, shared);
+			head->childs.push_back(child);
+			for (size_t i = 0; i < cur->childs.size(); i++) {
+				if (cur->childs[i] == child)
+					cur->childs[i] = head;
+			}
+			child = head;
+		}
+		cur = child;
+		depth += shared;
+	}
+
+	cur->vals.push_back(value);
+	return cur->vals.size();
+}
+
+//=================================================================================================
+//	void removeValues
+//	unmaps every value from key and frees the memory they used. The nodes of key stay in the tree
+//=================================================================================================
+template<typename ValueType>
+void RadixTrie<ValueType>::removeValues(const std::string &key) {
+	Node *cur = m_root;
+	size_t depth = 0;
+	while (depth < key.size()) {
+		Node *child = findChild(cur, key[depth]);
+		if (child == nullptr || sharedLength(child->label, key, depth) < child->label.size())
+			return;	// nothing is mapped to key
+		cur = child;
+		depth += child->label.size();
+	}
+	std::vector<ValueType>().swap(cur->vals);
+}
+
+//=================================================================================================
+//	std::vector<ValueType> find
+//	find the values mapped to key as well as those mapped to a key with one char difference
+//	(excluding the first char) unless exactMatchOnly is true
+//=================================================================================================
+template<typename ValueType>
+std::vector<ValueType> RadixTrie<ValueType>::find(const std::string &key, bool exactMatchOnly) const {
+	return findWithMismatches(key, exactMatchOnly ? 0 : 1);
+}
+
+//=================================================================================================
+//	std::vector<ValueType> findWithMismatches
+//	find the values mapped to key as well as those mapped to a key with up to maxMismatches chars
+//	different (excluding the first char)
+//=================================================================================================
+template<typename ValueType>
+std::vector<ValueType> RadixTrie<ValueType>::findWithMismatches(const std::string &key, int maxMismatches) const {
+	std::vector<ValueType> values;
+	const Node *first = findChild(m_root, key[0]);	// the first char must match exactly
+	if (first != nullptr)
+		findNode(first, key, 0, maxMismatches, values);
+	return values;
+}
+
+//=================================================================================================
+//	size_t countWithMismatches
+//	returns how many values findWithMismatches would return, without copying any of them
+//=================================================================================================
+template<typename ValueType>
+size_t RadixTrie<ValueType>::countWithMismatches(const std::string &key, int maxMismatches) const {
+	const Node *first = findChild(m_root, key[0]);
+	return first == nullptr ? 0 : countNode(first, key, 0, maxMismatches);
+}
+
+//=================================================================================================
+//	size_t nodeCount
+//	returns the number of nodes in the tree, including the root
+//=================================================================================================
+template<typename ValueType>
+size_t RadixTrie<ValueType>::nodeCount() const {
+	return nodesBelow(m_root);
+}
+
+//=================================================================================================
+//	PRIVATE MEMBERS
+//=================================================================================================
+
+//=================================================================================================
+//	struct Node
+//	contains the label of chars leading to it from its parent, a vector of values, and a vector of
+//	child pointers. No two children of a node share the first char of their labels
+//=================================================================================================
+template<typename ValueType>
+struct RadixTrie<ValueType>::Node {
+	std::string label;
+	std::vector<ValueType> vals;
+	std::vector<Node*> childs;
+};
+
+//=================================================================================================
+//	void deleteNode
+//	recursively deletes each node in the tree
+//=================================================================================================
+template<typename ValueType>
+void RadixTrie<ValueType>::deleteNode(Node *root) {
+	for (size_t i = 0; i < root->childs.size(); i++)
+		deleteNode(root->childs[i]);
+	delete root;
+}
+
+//=================================================================================================
+//	Node* findChild
+//	returns root's child whose label starts with first, or nullptr if it has none
+//=================================================================================================
+template<typename ValueType>
+typename RadixTrie<ValueType>::Node* RadixTrie<ValueType>::findChild(const Node *root, const char first) const {
+	for (size_t i = 0; i < root->childs.size(); i++) {
+		if (first == root->childs[i]->label[0])
+			return root->childs[i];
+	}
+	return nullptr;
+}
+
+//=================================================================================================
+//	size_t sharedLength
+//	returns how many chars at the start of label match key from position depth on
+//=================================================================================================
+template<typename ValueType>
+size_t RadixTrie<ValueType>::sharedLength(const std::string &label, const std::string &key, size_t depth) const {
+	size_t shared = 0;
+	while (shared < label.size() && depth + shared < key.size() && label[shared] == key[depth + shared])
+		shared++;
+	return shared;
+}
+
+//=================================================================================================
+//	bool matchLabel
+//	returns true if root's label fits within key from position depth on with at most
+//	mismatchesLeft chars different, and takes the ones it spends from mismatchesLeft
+//=================================================================================================
+template<typename ValueType>
+bool RadixTrie<ValueType>::matchLabel(const Node *root, const std::string &key, size_t depth, int &mismatchesLeft) const {
+	const std::string &label = root->label;
+	if (depth + label.size() > key.size())	// key ends partway along the label
+		return false;
+	for (size_t i = 0; i < label.size(); i++) {
+		if (label[i] != key[depth + i] && --mismatchesLeft < 0)
+			return false;
+	}
+	return true;
+}
+
+//=================================================================================================
+//	void findNode
+//	recursively match root's label against key from position depth on, then continue into its
+//	children, spending at most mismatchesLeft mismatches along the way, and add the values of the
+//	node where key ends to vals
+//=================================================================================================
+template<typename ValueType>
+void RadixTrie<ValueType>::findNode(const Node *root, const std::string &key, size_t depth, int mismatchesLeft, std::vector<ValueType> &vals) const {
+	if (!matchLabel(root, key, depth, mismatchesLeft))
+		return;
+	depth += root->label.size();
+
+	if (depth == key.size()) {	// base case: reached end of key so add its vals
+		vals.insert(vals.end(), root->vals.begin(), root->vals.end());
+		return;
+	}
+
+	if (mismatchesLeft == 0) {	// budget spent so only the child matching key can lead anywhere
+		const Node *child = findChild(root, key[depth]);
+		if (child != nullptr)
+			findNode(child, key, depth, 0, vals);
+		return;
+	}
+
+	for (size_t i = 0; i < root->childs.size(); i++)
+		findNode(root->childs[i], key, depth, mismatchesLeft, vals);
+}
+
+//=================================================================================================
+//	size_t countNode
+//	returns how many values findNode would add from root, without copying any of them
+//=================================================================================================
+template<typename ValueType>
+size_t RadixTrie<ValueType>::countNode(const Node *root, const std::string &key, size_t depth, int mismatchesLeft) const {
+	if (!matchLabel(root, key, depth, mismatchesLeft))
+		return 0;
+	depth += root->label.size();
+
+	if (depth == key.size())
+		return root->vals.size();
+
+	if (mismatchesLeft == 0) {
+		const Node *child = findChild(root, key[depth]);
+		return child == nullptr ? 0 : countNode(child, key, depth, 0);
+	}
+
+	size_t count = 0;
+	for (size_t i = 0; i < root->childs.size(); i++)
+		count += countNode(root->childs[i], key, depth, mismatchesLeft);
+	return count;
+}
+
+//=================================================================================================
+//	size_t nodesBelow
+//	returns the number of nodes in root's subtree, including root
+//=================================================================================================
+template<typename ValueType>
+size_t RadixTrie<ValueType>::nodesBelow(const Node *root) const {
+	size_t count = 1;
+	for (size_t i = 0; i < root->childs.size(); i++)
+		count += nodesBelow(root->childs[i]);
+	return count;
+}
+
+#endif // RADIXTRIE_INCLUDED
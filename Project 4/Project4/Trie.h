@@ -3,34 +3,352 @@
 
 #include <string>
 #include <vector>
+#include <algorithm>
+#include <memory>
+#include <new>
 
+#if defined(_MSC_VER)
+#include <xmmintrin.h>
+#define TRIE_PREFETCH(ptr) _mm_prefetch((const char *)(ptr), _MM_HINT_T0)
+#else
+#define TRIE_PREFETCH(ptr) __builtin_prefetch(ptr)
+#endif
+
+//=================================================================================================
+//	struct AnyChar / DnaAlphabet
+//	alphabet policies for Trie. With AnyChar, the default, keys may hold any char and each node
+//	keeps its children in a vector. Otherwise size is how many chars keys may hold and index maps
+//	each of them to a distinct slot below size (and any other char to -1), so each node keeps its
+//	children in arrays of size slots inside the node and finds a child without searching
+//=================================================================================================
+struct AnyChar {
+	static const int size = 0;
+	static int index(char) { return -1; }
+};
+
+struct DnaAlphabet {
+	static const int size = 5;
+	static int index(char ch) {
+		switch (ch) {
+		case 'A': return 0;
+		case 'C': return 1;
+		case 'G': return 2;
+		case 'T': return 3;
+		case 'N': return 4;
+		default: return -1;
+		}
+	}
+};
+
+//=================================================================================================
+//	class TrieChildren
+//	the children of a Trie node, in the order they were added, under the node's Alphabet
+//=================================================================================================
+template<typename NodeType, typename Alphabet, bool Fixed = (Alphabet::size > 0)>
+class TrieChildren
+{
+public:
+	size_t size() const { return m_nodes.size(); }
+	NodeType* operator[](size_t i) const { return m_nodes[i]; }
+	NodeType* find(const char id) const {
+		for (size_t i = 0; i < m_nodes.size(); i++) {
+			if (id == m_nodes[i]->id)
+				return m_nodes[i];
+		}
+		return nullptr;
+	}
+	void push_back(NodeType *child) { m_nodes.push_back(child); }
+	void clear() { std::vector<NodeType*>().swap(m_nodes); }
+private:
+	std::vector<NodeType*> m_nodes;
+};
+
+template<typename NodeType, typename Alphabet>
+class TrieChildren<NodeType, Alphabet, true>
+{
+public:
+	TrieChildren() { clear(); }
+	size_t size() const { return m_count; }
+	NodeType* operator[](size_t i) const { return m_nodes[i]; }
+	NodeType* find(const char id) const {
+		int slot = Alphabet::index(id);
+		return slot < 0 || m_slots[slot] < 0 ? nullptr : m_nodes[m_slots[slot]];
+	}
+	void push_back(NodeType *child) {	// child's id must be in the alphabet, as Trie::insert checks
+		m_slots[Alphabet::index(child->id)] = (signed char)m_count;
+		m_nodes[m_count++] = child;
+	}
+	void clear() {
+		m_count = 0;
+		std::fill(m_slots, m_slots + Alphabet::size, (signed char)-1);
+	}
+private:
+	NodeType *m_nodes[Alphabet::size];
+	signed char m_slots[Alphabet::size];	// where the child with each char is in m_nodes, or -1
+	unsigned char m_count;
+};
+
+//=================================================================================================
+//	class TrieValues
+//	the values of a Trie node that has any. As many values as fit in the space of a pointer, and at
+//	least MinInline, are kept inline; past that they move to the heap, growing by doubling. So a
+//	node with only a few values makes no allocation of its own
+//=================================================================================================
+template<typename ValueType, size_t MinInline = 2>
+class TrieValues
+{
+public:
+	TrieValues() : m_size(0) {}
+	~TrieValues() { clear(); }
+	size_t size() const { return m_size; }
+	bool empty() const { return m_size == 0; }
+	ValueType* data() { return m_size > INLINE ? m_heap : reinterpret_cast<ValueType*>(m_inline); }
+	const ValueType* data() const { return m_size > INLINE ? m_heap : reinterpret_cast<const ValueType*>(m_inline); }
+	ValueType& operator[](size_t i) { return data()[i]; }
+	void push_back(const ValueType &value);
+	template<typename Iterator> void assign(Iterator begin, Iterator end);
+	void take(TrieValues &other);
+	void clear();
+
+	TrieValues(const TrieValues&) = delete;
+	TrieValues& operator=(const TrieValues&) = delete;
+private:
+	static const size_t INLINE = sizeof(void*) / sizeof(ValueType) > MinInline ? sizeof(void*) / sizeof(ValueType) : MinInline;
+	union {
+		ValueType *m_heap;	// used once there are more than INLINE values
+		alignas(ValueType) unsigned char m_inline[INLINE * sizeof(ValueType)];
+	};
+	unsigned m_size;
+
+		// returns how many values the storage for size values has room for
+	static size_t capacityFor(size_t size) {
+		size_t capacity = INLINE;
+		while (capacity < size)
+			capacity = capacity <= INLINE ? INLINE + 1 : capacity * 2;
+		return capacity;
+	}
+	ValueType* allocate(size_t capacity) { return static_cast<ValueType*>(::operator new(capacity * sizeof(ValueType))); }
+};
+
+//=================================================================================================
+//	void push_back
+//	adds value after the others, moving them to a larger heap block first if they fill their room
+//=================================================================================================
+template<typename ValueType, size_t MinInline>
+void TrieValues<ValueType, MinInline>::push_back(const ValueType &value) {
+	if (m_size < capacityFor(m_size)) {
+		new (data() + m_size) ValueType(value);
+		m_size++;
+		return;
+	}
+
+	ValueType *old = data();
+	ValueType *grown = allocate(capacityFor(m_size + 1));
+	for (size_t i = 0; i < m_size; i++) {
+		new (grown + i) ValueType(std::move(old[i]));
+		old[i].~ValueType();
+	}
+	new (grown + m_size) ValueType(value);
+	if (m_size > INLINE)
+		::operator delete(old);
+	m_heap = grown;
+	m_size++;
+}
+
+//=================================================================================================
+//	void assign
+//	replaces the values with copies of those from begin up to end
+//=================================================================================================
+template<typename ValueType, size_t MinInline>
+template<typename Iterator>
+void TrieValues<ValueType, MinInline>::assign(Iterator begin, Iterator end) {
+	clear();
+	size_t size = end - begin;
+	ValueType *values = size > INLINE ? allocate(capacityFor(size)) : reinterpret_cast<ValueType*>(m_inline);
+	for (size_t i = 0; i < size; i++, ++begin)
+		new (values + i) ValueType(*begin);
+	if (size > INLINE)
+		m_heap = values;
+	m_size = (unsigned)size;
+}
+
+//=================================================================================================
+//	void take
+//	moves other's values here, taking over its heap block if it has one, and leaves other empty.
+//	These values must be empty
+//=================================================================================================
+template<typename ValueType, size_t MinInline>
+void TrieValues<ValueType, MinInline>::take(TrieValues &other) {
+	if (other.m_size > INLINE)
+		m_heap = other.m_heap;
+	else {
+		for (size_t i = 0; i < other.m_size; i++) {
+			new (reinterpret_cast<ValueType*>(m_inline) + i) ValueType(std::move(other[i]));
+			other[i].~ValueType();
+		}
+	}
+	m_size = other.m_size;
+	other.m_size = 0;
+}
+
+//=================================================================================================
+//	void clear
+//	destroys every value and frees the heap block if there is one
+//=================================================================================================
+template<typename ValueType, size_t MinInline>
+void TrieValues<ValueType, MinInline>::clear() {
+	ValueType *values = data();
+	for (size_t i = 0; i < m_size; i++)
+		values[i].~ValueType();
+	if (m_size > INLINE)
+		::operator delete(values);
+	m_size = 0;
+}
+
+//=================================================================================================
+//	class TrieValuePool
+//	the TrieValues of a Trie's nodes. A node gets one only once a value is mapped to it and keeps
+//	its index, so a node with no values, like every interior node of a tree of same-length keys,
+//	pays for an index in what would otherwise be padding. The TrieValues are allocated CHUNK_SIZE
+//	at a time and never move, so indices and references stay valid as the pool grows. Index 0 is
+//	never handed out, so that a node can use it to say it has no values
+//=================================================================================================
 template<typename ValueType>
+class TrieValuePool
+{
+public:
+	TrieValuePool() : m_size(1) {}
+	unsigned add();
+	TrieValues<ValueType>& operator[](unsigned i) { return m_chunks[i / CHUNK_SIZE][i % CHUNK_SIZE]; }
+	const TrieValues<ValueType>& operator[](unsigned i) const { return m_chunks[i / CHUNK_SIZE][i % CHUNK_SIZE]; }
+	void clear();
+	void swap(TrieValuePool &other) { m_chunks.swap(other.m_chunks); std::swap(m_size, other.m_size); }
+
+	TrieValuePool(const TrieValuePool&) = delete;
+	TrieValuePool& operator=(const TrieValuePool&) = delete;
+private:
+	static const size_t CHUNK_SIZE = 4096;
+	std::vector<std::unique_ptr<TrieValues<ValueType>[]>> m_chunks;
+	size_t m_size;	// number of indices handed out, counting 0
+};
+
+//=================================================================================================
+//	unsigned add
+//	returns the index of new, empty TrieValues, allocating another chunk first if the last is full
+//=================================================================================================
+template<typename ValueType>
+unsigned TrieValuePool<ValueType>::add() {
+	if (m_size >= m_chunks.size() * CHUNK_SIZE)
+		m_chunks.emplace_back(new TrieValues<ValueType>[CHUNK_SIZE]);
+	return (unsigned)m_size++;
+}
+
+//=================================================================================================
+//	void clear
+//	destroys every TrieValues and frees the chunks, so no index handed out before is valid
+//=================================================================================================
+template<typename ValueType>
+void TrieValuePool<ValueType>::clear() {
+	std::vector<std::unique_ptr<TrieValues<ValueType>[]>>().swap(m_chunks);
+	m_size = 1;
+}
+
+//=================================================================================================
+//	class Trie
+//	maps string keys to values. Alphabet is the policy for which chars keys may hold. KeyLength,
+//	if not 0, is the length every key must have: keys of any other length are left out and find
+//	nothing. It only gives the loops over a key a constant bound. Keys are not packed into
+//	integers and the loops are not unrolled, so it checks keys more than it speeds them up
+//=================================================================================================
+template<typename ValueType, typename Alphabet = AnyChar, size_t KeyLength = 0>
 class Trie
 {
 public:
 	Trie();
 	~Trie();
 	void reset();
-	void insert(const std::string &key, const ValueType &value);
+	size_t insert(const std::string &key, const ValueType &value);
+	void removeValues(const std::string &key);
 	std::vector<ValueType> find(const std::string &key, bool exactMatchOnly) const;
+	std::vector<ValueType> findWithMismatches(const std::string &key, int maxMismatches) const;
+	size_t countWithMismatches(const std::string &key, int maxMismatches) const;
+	void findBatch(const std::vector<std::string> &keys, bool exactMatchOnly, std::vector<std::vector<ValueType>> &results) const;
+	void findBatchWithMismatches(const std::vector<std::string> &keys, int maxMismatches, std::vector<std::vector<ValueType>> &results) const;
+	template<typename Visitor> void drain(Visitor visit);
+	template<typename Adjust> void merge(Trie &other, Adjust adjust);
+	void copy(const Trie &other);
+	void swap(Trie &other);
+	void freeze();
+	size_t nodeCount() const;
 
 	  // C++11 syntax for preventing copying and assignment
 	Trie(const Trie&) = delete;
 	Trie& operator=(const Trie&) = delete;
 private:
 	struct Node;
-	Node *m_root;
+	struct FlatNode;
+	Node *m_root;	// nullptr while frozen
+	TrieValuePool<ValueType> m_values;	// the values of every node that has had any, empty while frozen
+	std::vector<FlatNode> m_flatNodes;	// the tree in breadth-first order while frozen, then a sentinel
+	std::vector<ValueType> m_flatValues;	// the values of every node in m_flatNodes, in the same order
 
 		// called by destructor and reset
 	void deleteNode(Node *root);
 
+		// called by insert, removeValues, drain and merge
+	void thaw();
+
+		// called by insert, thaw, merge and copy
+	TrieValues<ValueType>& valuesOf(Node *node);
+
 		// called by insert
+	bool inAlphabet(const std::string &key) const;
 	bool isChild(const Node *root, const char id, Node *&child) const;
+
+		// called by insert and copy
 	Node* createNode(Node *root, const char id);
 
+		// return whether key has KeyLength chars, if that is not 0, and how many chars of it the
+		// tree uses
+	bool hasKeyLength(const std::string &key) const { return KeyLength == 0 || key.size() == KeyLength; }
+	size_t keySize(const std::string &key) const { return KeyLength > 0 ? KeyLength : key.size(); }
+
+		// let each search be written once for both layouts
+	size_t childCount(const Node *root) const { return root->childs.size(); }
+	const Node* child(const Node *root, size_t i) const { return root->childs[i]; }
+	const ValueType* valuesBegin(const Node *root) const { return root->values == 0 ? nullptr : m_values[root->values].data(); }
+	const ValueType* valuesEnd(const Node *root) const { return root->values == 0 ? nullptr : m_values[root->values].data() + m_values[root->values].size(); }
+	size_t childCount(const FlatNode *root) const { return root->childCount; }
+	const FlatNode* child(const FlatNode *root, size_t i) const { return &m_flatNodes[root->firstChild + i]; }
+	const ValueType* valuesBegin(const FlatNode *root) const { return m_flatValues.data() + root->valuesBegin; }
+	const ValueType* valuesEnd(const FlatNode *root) const { return m_flatValues.data() + (root + 1)->valuesBegin; }
+	const Node* findChild(const Node *root, const char id) const { return root->childs.find(id); }
+	const FlatNode* findChild(const FlatNode *root, const char id) const;
+
 		// called by find
-	void findNode(const Node *root, const std::string &key, bool exactMatchOnly, std::vector<ValueType> &vals) const;
-	void fillVector(const std::vector<ValueType> &filler, std::vector<ValueType> &fillMe) const;
+	template<typename NodePtr> void findNode(NodePtr root, const std::string &key, size_t depth, int mismatchesLeft, std::vector<ValueType> &vals) const;
+	void fillVector(const ValueType *begin, const ValueType *end, std::vector<ValueType> &fillMe) const;
+
+		// called by countWithMismatches
+	template<typename NodePtr> size_t countNode(NodePtr root, const std::string &key, size_t depth, int mismatchesLeft) const;
+
+		// called by nodeCount
+	size_t nodesBelow(const Node *root) const;
+
+		// called by drain
+	template<typename Visitor> void drainNode(Node *root, std::string &key, std::vector<ValueType> &vals, Visitor &visit);
+
+		// called by copy
+	void copyNode(Node *root, const Node *from, const Trie &other);
+
+		// called by merge
+	template<typename Adjust> void mergeNode(Node *root, Node *from, Trie &other, Adjust &adjust);
+	template<typename Adjust> void adoptNode(Node *root, Trie &other, Adjust &adjust);
+
+		// called by findBatchWithMismatches
+	struct Cursor;
+	template<typename NodePtr> void findRootBatch(NodePtr root, const std::vector<std::string> &keys, const std::vector<size_t> &order, int maxMismatches, std::vector<std::vector<ValueType>> &results) const;
+	template<typename NodePtr> void findNodeBatch(NodePtr root, size_t depth, const std::vector<std::string> &keys, const std::vector<Cursor> &cursors, std::vector<std::vector<ValueType>> &results) const;
 };
 
 //=================================================================================================
@@ -41,8 +359,8 @@ private:
 //	constructor
 //	dynamically allocates the root node with m_root
 //=================================================================================================
-template<typename ValueType>
-Trie<ValueType>::Trie() {
+template<typename ValueType, typename Alphabet, size_t KeyLength>
+Trie<ValueType, Alphabet, KeyLength>::Trie() {
 	m_root = new Node;
 }
 
@@ -50,30 +368,40 @@ Trie<ValueType>::Trie() {
 //	destructor
 //	deletes each node in the tree using deleteNode
 //=================================================================================================
-template<typename ValueType>
-Trie<ValueType>::~Trie() {
-	deleteNode(m_root);
+template<typename ValueType, typename Alphabet, size_t KeyLength>
+Trie<ValueType, Alphabet, KeyLength>::~Trie() {
+	if (m_root != nullptr)
+		deleteNode(m_root);
 }
 
 //=================================================================================================
 //	void reset
-//	deletes the entire tree and creates a new root node
+//	deletes the entire tree, frozen or not, and creates a new root node
 //=================================================================================================
-template<typename ValueType>
-void Trie<ValueType>::reset() {
-	deleteNode(m_root);
+template<typename ValueType, typename Alphabet, size_t KeyLength>
+void Trie<ValueType, Alphabet, KeyLength>::reset() {
+	if (m_root != nullptr)
+		deleteNode(m_root);
+	m_values.clear();
+	std::vector<FlatNode>().swap(m_flatNodes);
+	std::vector<ValueType>().swap(m_flatValues);
 	m_root = new Node;
 }
 
 //=================================================================================================
-//	void insert
-//	maps value to key using the tree structure
+//	size_t insert
+//	maps value to key using the tree structure and returns how many values key now maps to. A key
+//	with a char outside the Alphabet, or without KeyLength chars, has no place in the tree, so it
+//	is left out and 0 is returned
 //=================================================================================================
-template<typename ValueType>
-void Trie<ValueType>::insert(const std::string &key, const ValueType &value) {
+template<typename ValueType, typename Alphabet, size_t KeyLength>
+size_t Trie<ValueType, Alphabet, KeyLength>::insert(const std::string &key, const ValueType &value) {
+	if (!hasKeyLength(key) || !inAlphabet(key))
+		return 0;
+	thaw();
 	Node *cur = m_root;	// the current node being analyzed
 
-	for (size_t i = 0; i < key.size(); i++) {
+	for (size_t i = 0; i < keySize(key); i++) {
 		Node *temp;	//temporary holder for cur's child
 
 		if (!isChild(cur, key[i], temp))	// checks if cur already has a child with the given id
@@ -84,7 +412,29 @@ void Trie<ValueType>::insert(const std::string &key, const ValueType &value) {
 		cur = temp;	// sets cur to its child held in temp for next iteration
 	}
 
-	cur->vals.push_back(value);	// adds value to cur, which is the leaf node
+	TrieValues<ValueType> &vals = valuesOf(cur);
+	vals.push_back(value);	// adds value to cur, which is the leaf node
+	return vals.size();
+}
+
+//=================================================================================================
+//	void removeValues
+//	unmaps every value from key and frees the memory they used. The nodes of key stay in the tree
+//=================================================================================================
+template<typename ValueType, typename Alphabet, size_t KeyLength>
+void Trie<ValueType, Alphabet, KeyLength>::removeValues(const std::string &key) {
+	if (!hasKeyLength(key))
+		return;	// nothing can be mapped to key
+	thaw();
+	Node *cur = m_root;
+	for (size_t i = 0; i < keySize(key); i++) {
+		Node *child;
+		if (!isChild(cur, key[i], child))
+			return;	// nothing is mapped to key
+		cur = child;
+	}
+	if (cur->values != 0)
+		m_values[cur->values].clear();
 }
 
 //=================================================================================================
@@ -92,99 +442,574 @@ void Trie<ValueType>::insert(const std::string &key, const ValueType &value) {
 //	find the values mapped to key as well as those mapped to a key with one char difference
 //	(excluding the first char) unless exactMatchOnly is true
 //=================================================================================================
-template<typename ValueType>
-std::vector<ValueType> Trie<ValueType>::find(const std::string &key, bool exactMatchOnly) const {
+template<typename ValueType, typename Alphabet, size_t KeyLength>
+std::vector<ValueType> Trie<ValueType, Alphabet, KeyLength>::find(const std::string &key, bool exactMatchOnly) const {
+	return findWithMismatches(key, exactMatchOnly ? 0 : 1);
+}
+
+//=================================================================================================
+//	std::vector<ValueType> findWithMismatches
+//	find the values mapped to key as well as those mapped to a key with up to maxMismatches chars
+//	different (excluding the first char)
+//=================================================================================================
+template<typename ValueType, typename Alphabet, size_t KeyLength>
+std::vector<ValueType> Trie<ValueType, Alphabet, KeyLength>::findWithMismatches(const std::string &key, int maxMismatches) const {
 	std::vector<ValueType> values;
-	for (size_t i = 0; i < m_root->childs.size(); i++) {
-		if (key[0] == m_root->childs[i]->id)
-			findNode(m_root->childs[i], key.substr(1), exactMatchOnly, values);
+	if (!hasKeyLength(key))
+		return values;
+	if (m_root != nullptr) {
+		const Node *first = findChild(m_root, key[0]);	// the first char must match exactly
+		if (first != nullptr)
+			findNode(first, key, 1, maxMismatches, values);
+	}
+	else {
+		const FlatNode *first = findChild(m_flatNodes.data(), key[0]);
+		if (first != nullptr)
+			findNode(first, key, 1, maxMismatches, values);
 	}
 	return values;
 }
 
+//=================================================================================================
+//	size_t countWithMismatches
+//	returns how many values findWithMismatches(key, maxMismatches) would find, without copying them
+//=================================================================================================
+template<typename ValueType, typename Alphabet, size_t KeyLength>
+size_t Trie<ValueType, Alphabet, KeyLength>::countWithMismatches(const std::string &key, int maxMismatches) const {
+	if (!hasKeyLength(key))
+		return 0;
+	if (m_root != nullptr) {
+		const Node *first = findChild(m_root, key[0]);
+		return first == nullptr ? 0 : countNode(first, key, 1, maxMismatches);
+	}
+	const FlatNode *first = findChild(m_flatNodes.data(), key[0]);
+	return first == nullptr ? 0 : countNode(first, key, 1, maxMismatches);
+}
+
+//=================================================================================================
+//	void findBatch
+//	sets results[i] to find(keys[i], exactMatchOnly) for every key. Keys are sorted first so that
+//	keys sharing a prefix walk that part of the tree only once
+//=================================================================================================
+template<typename ValueType, typename Alphabet, size_t KeyLength>
+void Trie<ValueType, Alphabet, KeyLength>::findBatch(const std::vector<std::string> &keys, bool exactMatchOnly, std::vector<std::vector<ValueType>> &results) const {
+	findBatchWithMismatches(keys, exactMatchOnly ? 0 : 1, results);
+}
+
+//=================================================================================================
+//	void findBatchWithMismatches
+//	sets results[i] to findWithMismatches(keys[i], maxMismatches) for every key
+//=================================================================================================
+template<typename ValueType, typename Alphabet, size_t KeyLength>
+void Trie<ValueType, Alphabet, KeyLength>::findBatchWithMismatches(const std::vector<std::string> &keys, int maxMismatches, std::vector<std::vector<ValueType>> &results) const {
+	results.assign(keys.size(), std::vector<ValueType>());
+
+	std::vector<size_t> order;	// key indices sorted by key so shared prefixes are adjacent
+	for (size_t i = 0; i < keys.size(); i++) {
+		if (!keys[i].empty() && hasKeyLength(keys[i]))
+			order.push_back(i);
+	}
+	std::sort(order.begin(), order.end(), [&keys](size_t a, size_t b) { return keys[a] < keys[b]; });
+
+	if (m_root != nullptr)
+		findRootBatch<const Node*>(m_root, keys, order, maxMismatches, results);
+	else
+		findRootBatch(m_flatNodes.data(), keys, order, maxMismatches, results);
+}
+
+//=================================================================================================
+//	void drain
+//	calls visit(key, values) for every key that has values, in the order the tree is walked, and
+//	empties the tree as it goes. visit may move the values away. Since each node is deleted once
+//	it has been visited, the values can be copied into another structure without both being in
+//	memory in full at once
+//=================================================================================================
+template<typename ValueType, typename Alphabet, size_t KeyLength>
+template<typename Visitor>
+void Trie<ValueType, Alphabet, KeyLength>::drain(Visitor visit) {
+	thaw();
+	std::string key;
+	key.reserve(KeyLength);
+	std::vector<ValueType> vals;	// handed to visit with each node's values
+	drainNode(m_root, key, vals, visit);
+	m_root->values = 0;
+	m_values.clear();
+}
+
+//=================================================================================================
+//	void merge
+//	moves every value of other into this tree under the same key, after the values the key
+//	already has, calling adjust on each one first, and leaves other empty. Where only other has a
+//	branch, its nodes are relinked into this tree as they are rather than copied, so merging costs
+//	a walk of other's tree and not an insert per value
+//=================================================================================================
+template<typename ValueType, typename Alphabet, size_t KeyLength>
+template<typename Adjust>
+void Trie<ValueType, Alphabet, KeyLength>::merge(Trie &other, Adjust adjust) {
+	if (&other == this)
+		return;
+	thaw();
+	other.thaw();
+	mergeNode(m_root, other.m_root, other, adjust);
+	other.m_values.clear();
+}
+
+//=================================================================================================
+//	void copy
+//	replaces this tree with a copy of other's, frozen if other's is. Unlike merge, other is left as
+//	it was, so it costs an allocation per node
+//=================================================================================================
+template<typename ValueType, typename Alphabet, size_t KeyLength>
+void Trie<ValueType, Alphabet, KeyLength>::copy(const Trie &other) {
+	if (&other == this)
+		return;
+	reset();
+	if (other.m_root == nullptr) {
+		deleteNode(m_root);
+		m_root = nullptr;
+		m_flatNodes = other.m_flatNodes;
+		m_flatValues = other.m_flatValues;
+		return;
+	}
+	copyNode(m_root, other.m_root, other);
+}
+
+//=================================================================================================
+//	void swap
+//	exchanges this tree with other's, frozen or not, without touching their nodes or values
+//=================================================================================================
+template<typename ValueType, typename Alphabet, size_t KeyLength>
+void Trie<ValueType, Alphabet, KeyLength>::swap(Trie &other) {
+	std::swap(m_root, other.m_root);
+	m_values.swap(other.m_values);
+	m_flatNodes.swap(other.m_flatNodes);
+	m_flatValues.swap(other.m_flatValues);
+}
+
+//=================================================================================================
+//	void freeze
+//	rewrites the tree into m_flatNodes in breadth-first order, so the children of each node are
+//	side by side and found from one index, and moves every node's values into m_flatValues, so a
+//	node's values run up to where the next node's start. Searches then read the arrays instead of
+//	following pointers between separately allocated nodes. Each node is deleted, and its values
+//	freed, once its children are queued, so both layouts are never in memory in full at once. Changing the tree thaws it
+//	back into nodes first. The frozen tree may hold up to 2^32 - 1 nodes and values
+//=================================================================================================
+template<typename ValueType, typename Alphabet, size_t KeyLength>
+void Trie<ValueType, Alphabet, KeyLength>::freeze() {
+	if (m_root == nullptr)
+		return;
+
+	std::vector<Node*> order(1, m_root);	// every node in breadth-first order
+	for (size_t i = 0; i < order.size(); i++) {
+		Node *node = order[i];
+		FlatNode flat;
+		flat.id = node == m_root ? 0 : node->id;
+		flat.childCount = (unsigned short)node->childs.size();
+		flat.firstChild = (unsigned)order.size();
+		flat.valuesBegin = (unsigned)m_flatValues.size();
+		m_flatNodes.push_back(flat);
+		for (size_t j = 0; j < node->childs.size(); j++)
+			order.push_back(node->childs[j]);
+		if (node->values != 0) {
+			TrieValues<ValueType> &vals = m_values[node->values];
+			for (size_t j = 0; j < vals.size(); j++)
+				m_flatValues.push_back(std::move(vals[j]));
+			vals.clear();
+		}
+		delete node;
+	}
+	m_values.clear();
+
+	FlatNode sentinel = { 0, (unsigned)m_flatValues.size(), 0, 0 };	// where the last node's values end
+	m_flatNodes.push_back(sentinel);
+	m_flatNodes.shrink_to_fit();
+	m_flatValues.shrink_to_fit();
+	m_root = nullptr;
+}
+
+//=================================================================================================
+//	size_t nodeCount
+//	returns the number of nodes in the tree, frozen or not, including the root
+//=================================================================================================
+template<typename ValueType, typename Alphabet, size_t KeyLength>
+size_t Trie<ValueType, Alphabet, KeyLength>::nodeCount() const {
+	if (m_root == nullptr)
+		return m_flatNodes.size() - 1;	// without the sentinel
+	return nodesBelow(m_root);
+}
+
 //=================================================================================================
 //	PRIVATE MEMBERS
 //=================================================================================================
 
 //=================================================================================================
 //	struct Node
-//	contains a character id, a vector of values, and a vector of child pointers
+//	contains a character id, where its values are in m_values, and its child pointers
 //=================================================================================================
-template<typename ValueType>
-struct Trie<ValueType>::Node {
+template<typename ValueType, typename Alphabet, size_t KeyLength>
+struct Trie<ValueType, Alphabet, KeyLength>::Node {
+	char id;
+	unsigned values = 0;	// index of the node's values in m_values, or 0 if it has never had any
+	TrieChildren<Node, Alphabet> childs;
+};
+
+//=================================================================================================
+//	struct FlatNode
+//	a node of a frozen tree: its children are m_flatNodes[firstChild] onwards and its values are
+//	m_flatValues[valuesBegin] up to the next node's valuesBegin
+//=================================================================================================
+template<typename ValueType, typename Alphabet, size_t KeyLength>
+struct Trie<ValueType, Alphabet, KeyLength>::FlatNode {
+	unsigned firstChild;
+	unsigned valuesBegin;
+	unsigned short childCount;
 	char id;
-	std::vector<ValueType> vals;
-	std::vector<Node*> childs;
+};
+
+//=================================================================================================
+//	struct Cursor
+//	a key taking part in a batched search: its index in the batch and how many more mismatches it
+//	may still use
+//=================================================================================================
+template<typename ValueType, typename Alphabet, size_t KeyLength>
+struct Trie<ValueType, Alphabet, KeyLength>::Cursor {
+	size_t keyIndex;
+	int mismatchesLeft;
 };
 
 //=================================================================================================
 //	void deleteNode
 //	deletes the given root node as well as all children branching from the root
 //=================================================================================================
-template<typename ValueType>
-void Trie<ValueType>::deleteNode(Node *root) {
+template<typename ValueType, typename Alphabet, size_t KeyLength>
+void Trie<ValueType, Alphabet, KeyLength>::deleteNode(Node *root) {
 	for (size_t i = 0; i < root->childs.size(); i++)
 		deleteNode(root->childs[i]);
 	delete root;
 }
 
+//=================================================================================================
+//	void thaw
+//	if the tree is frozen, rebuilds it as nodes, allocated in breadth-first order, and frees the
+//	frozen arrays
+//=================================================================================================
+template<typename ValueType, typename Alphabet, size_t KeyLength>
+void Trie<ValueType, Alphabet, KeyLength>::thaw() {
+	if (m_root != nullptr)
+		return;
+
+	std::vector<Node*> nodes(m_flatNodes.size() - 1);	// without the sentinel
+	for (size_t i = 0; i < nodes.size(); i++) {
+		nodes[i] = new Node;
+		nodes[i]->id = m_flatNodes[i].id;
+	}
+	for (size_t i = 0; i < nodes.size(); i++) {
+		const FlatNode &flat = m_flatNodes[i];
+		for (size_t j = 0; j < flat.childCount; j++)
+			nodes[i]->childs.push_back(nodes[flat.firstChild + j]);
+		if (m_flatNodes[i + 1].valuesBegin > flat.valuesBegin)
+			valuesOf(nodes[i]).assign(m_flatValues.begin() + flat.valuesBegin, m_flatValues.begin() + m_flatNodes[i + 1].valuesBegin);
+	}
+	m_root = nodes[0];
+	std::vector<FlatNode>().swap(m_flatNodes);
+	std::vector<ValueType>().swap(m_flatValues);
+}
+
+//=================================================================================================
+//	size_t nodesBelow
+//	returns the number of nodes in root's subtree, including root
+//=================================================================================================
+template<typename ValueType, typename Alphabet, size_t KeyLength>
+size_t Trie<ValueType, Alphabet, KeyLength>::nodesBelow(const Node *root) const {
+	size_t count = 1;
+	for (size_t i = 0; i < root->childs.size(); i++)
+		count += nodesBelow(root->childs[i]);
+	return count;
+}
+
+//=================================================================================================
+//	void copyNode
+//	recursively copies from's values, which are in other's m_values, to root, and gives root a
+//	copy of each of from's children
+//=================================================================================================
+template<typename ValueType, typename Alphabet, size_t KeyLength>
+void Trie<ValueType, Alphabet, KeyLength>::copyNode(Node *root, const Node *from, const Trie &other) {
+	if (from->values != 0 && !other.m_values[from->values].empty()) {
+		const TrieValues<ValueType> &fromVals = other.m_values[from->values];
+		valuesOf(root).assign(fromVals.data(), fromVals.data() + fromVals.size());
+	}
+	for (size_t i = 0; i < from->childs.size(); i++)
+		copyNode(createNode(root, from->childs[i]->id), from->childs[i], other);
+}
+
+//=================================================================================================
+//	void mergeNode
+//	recursively moves from's values, which are in other's m_values, onto root's, then each of
+//	from's children onto root's child with the same id, deleting it once it is empty, or hangs it
+//	off root with adoptNode if root has no such child. Leaves from with no values or children
+//=================================================================================================
+template<typename ValueType, typename Alphabet, size_t KeyLength>
+template<typename Adjust>
+void Trie<ValueType, Alphabet, KeyLength>::mergeNode(Node *root, Node *from, Trie &other, Adjust &adjust) {
+	if (from->values != 0 && !other.m_values[from->values].empty()) {
+		TrieValues<ValueType> &fromVals = other.m_values[from->values];
+		TrieValues<ValueType> &vals = valuesOf(root);
+		size_t had = vals.size();
+		if (had == 0)	// nothing to append to, so take the values as they are
+			vals.take(fromVals);
+		else {
+			for (size_t i = 0; i < fromVals.size(); i++)
+				vals.push_back(fromVals[i]);
+			fromVals.clear();
+		}
+		for (size_t i = had; i < vals.size(); i++)
+			adjust(vals[i]);
+	}
+	from->values = 0;
+
+	for (size_t i = 0; i < from->childs.size(); i++) {
+		Node *child = from->childs[i];
+		Node *same = root->childs.find(child->id);
+		if (same == nullptr) {	// nothing to merge with, so the whole branch moves over
+			adoptNode(child, other, adjust);
+			root->childs.push_back(child);
+		}
+		else {
+			mergeNode(same, child, other, adjust);
+			delete child;
+		}
+	}
+	from->childs.clear();
+}
+
+//=================================================================================================
+//	void adoptNode
+//	moves the values of every node in root's subtree from other's m_values into this tree's,
+//	calling adjust on each, so the subtree can be hung off a node of this tree
+//=================================================================================================
+template<typename ValueType, typename Alphabet, size_t KeyLength>
+template<typename Adjust>
+void Trie<ValueType, Alphabet, KeyLength>::adoptNode(Node *root, Trie &other, Adjust &adjust) {
+	if (root->values != 0 && !other.m_values[root->values].empty()) {
+		unsigned index = m_values.add();
+		TrieValues<ValueType> &vals = m_values[index];
+		vals.take(other.m_values[root->values]);
+		for (size_t i = 0; i < vals.size(); i++)
+			adjust(vals[i]);
+		root->values = index;
+	}
+	else
+		root->values = 0;
+	for (size_t i = 0; i < root->childs.size(); i++)
+		adoptNode(root->childs[i], other, adjust);
+}
+
+//=================================================================================================
+//	void drainNode
+//	calls visit on root, whose key is key, with its values copied into vals if it has any and
+//	frees them, then drains and deletes each of its children
+//=================================================================================================
+template<typename ValueType, typename Alphabet, size_t KeyLength>
+template<typename Visitor>
+void Trie<ValueType, Alphabet, KeyLength>::drainNode(Node *root, std::string &key, std::vector<ValueType> &vals, Visitor &visit) {
+	if (root->values != 0 && !m_values[root->values].empty()) {
+		TrieValues<ValueType> &nodeVals = m_values[root->values];
+		vals.assign(nodeVals.data(), nodeVals.data() + nodeVals.size());
+		nodeVals.clear();
+		visit(key, vals);
+	}
+	for (size_t i = 0; i < root->childs.size(); i++) {
+		key.push_back(root->childs[i]->id);
+		drainNode(root->childs[i], key, vals, visit);
+		key.pop_back();
+		delete root->childs[i];
+	}
+	root->childs.clear();
+}
+
+//=================================================================================================
+//	TrieValues<ValueType>& valuesOf
+//	returns node's values, giving it an empty place in m_values first if it has none
+//=================================================================================================
+template<typename ValueType, typename Alphabet, size_t KeyLength>
+TrieValues<ValueType>& Trie<ValueType, Alphabet, KeyLength>::valuesOf(Node *node) {
+	if (node->values == 0)
+		node->values = m_values.add();
+	return m_values[node->values];
+}
+
+//=================================================================================================
+//	bool inAlphabet
+//	returns true if every char of key that the tree uses is in the Alphabet. Any char is with AnyChar
+//=================================================================================================
+template<typename ValueType, typename Alphabet, size_t KeyLength>
+bool Trie<ValueType, Alphabet, KeyLength>::inAlphabet(const std::string &key) const {
+	if (Alphabet::size == 0)
+		return true;
+	for (size_t i = 0; i < keySize(key); i++) {
+		if (Alphabet::index(key[i]) < 0)
+			return false;
+	}
+	return true;
+}
+
 //=================================================================================================
 //	bool isChild
 //	returns true if root has a child with the given id and sets child to that particular child
 //	otherwise, returns false and leaves child unchanged
 //=================================================================================================
-template<typename ValueType>
-bool Trie<ValueType>::isChild(const Node *root, const char id, Node *&child) const {
-	for (int i = 0; i < root->childs.size(); i++) {
-		if (id == root->childs[i]->id) {
-			child = root->childs[i];
-			return true;
-		}
-	}
-	return false;
+template<typename ValueType, typename Alphabet, size_t KeyLength>
+bool Trie<ValueType, Alphabet, KeyLength>::isChild(const Node *root, const char id, Node *&child) const {
+	Node *found = root->childs.find(id);
+	if (found == nullptr)
+		return false;
+	child = found;
+	return true;
 }
 
 //=================================================================================================
 //	Node* createNode
 //	creates a new child of root with specified id and returns a pointer to this child
 //=================================================================================================
-template<typename ValueType>
-typename Trie<ValueType>::Node* Trie<ValueType>::createNode(Node *root, char id) {
+template<typename ValueType, typename Alphabet, size_t KeyLength>
+typename Trie<ValueType, Alphabet, KeyLength>::Node* Trie<ValueType, Alphabet, KeyLength>::createNode(Node *root, char id) {
 	Node *child = new Node;
 	child->id = id;
 	root->childs.push_back(child);
 	return child;
 }
 
+//=================================================================================================
+//	const FlatNode* findChild
+//	returns the frozen root's child with the given id, or nullptr if it has none
+//=================================================================================================
+template<typename ValueType, typename Alphabet, size_t KeyLength>
+const typename Trie<ValueType, Alphabet, KeyLength>::FlatNode* Trie<ValueType, Alphabet, KeyLength>::findChild(const FlatNode *root, const char id) const {
+	for (size_t i = 0; i < childCount(root); i++) {
+		if (id == child(root, i)->id)
+			return child(root, i);
+	}
+	return nullptr;
+}
+
 //=================================================================================================
 //	void findNode
-//	recursively find the node with the given key and add its values to vals
+//	recursively find the node matching key from position depth on, spending at most mismatchesLeft
+//	mismatches, and add its values to vals
 //=================================================================================================
-template<typename ValueType>
-void Trie<ValueType>::findNode(const Node *root, const std::string &key, bool exactMatchOnly, std::vector<ValueType> &vals) const {
-	if (key.empty()) {	// base case: reached end of key on leaf node so add its vals
-		fillVector(root->vals, vals);
+template<typename ValueType, typename Alphabet, size_t KeyLength>
+template<typename NodePtr>
+void Trie<ValueType, Alphabet, KeyLength>::findNode(NodePtr root, const std::string &key, size_t depth, int mismatchesLeft, std::vector<ValueType> &vals) const {
+	if (depth == keySize(key)) {	// base case: reached end of key on leaf node so add its vals
+		fillVector(valuesBegin(root), valuesEnd(root), vals);
 		return;
 	}
 
-	for (size_t i = 0; i < root->childs.size(); i++) {
-		if (key[0] == root->childs[i]->id)	// current char of key matches child's id so call
-											// recursively on child
-			findNode(root->childs[i], key.substr(1), exactMatchOnly, vals);
-		else if (!exactMatchOnly)	// current char of key doesn't match child's id but
-									// exactMatchOnly is false so call recursively with true
-			findNode(root->childs[i], key.substr(1), true, vals);
+	if (mismatchesLeft == 0) {	// budget spent so only the child matching key can lead anywhere
+		NodePtr next = findChild(root, key[depth]);
+		if (next != nullptr)
+			findNode(next, key, depth + 1, 0, vals);
+		return;
+	}
+
+	for (size_t i = 0; i < childCount(root); i++) {
+		if (key[depth] == child(root, i)->id)	// current char of key matches child's id so
+												// call recursively on child
+			findNode(child(root, i), key, depth + 1, mismatchesLeft, vals);
+		else	// current char of key doesn't match child's id so spend one mismatch on it
+			findNode(child(root, i), key, depth + 1, mismatchesLeft - 1, vals);
+	}
+}
+
+//=================================================================================================
+//	size_t countNode
+//	walks the tree like findNode, but adds up the number of values it reaches instead of copying
+//	them
+//=================================================================================================
+template<typename ValueType, typename Alphabet, size_t KeyLength>
+template<typename NodePtr>
+size_t Trie<ValueType, Alphabet, KeyLength>::countNode(NodePtr root, const std::string &key, size_t depth, int mismatchesLeft) const {
+	if (depth == keySize(key))
+		return valuesEnd(root) - valuesBegin(root);
+
+	if (mismatchesLeft == 0) {
+		NodePtr next = findChild(root, key[depth]);
+		if (next != nullptr)
+			return countNode(next, key, depth + 1, 0);
+		return 0;
 	}
+
+	size_t count = 0;
+	for (size_t i = 0; i < childCount(root); i++)
+		count += countNode(child(root, i), key, depth + 1, mismatchesLeft - (key[depth] == child(root, i)->id ? 0 : 1));
+	return count;
 }
 
 //=================================================================================================
 //	void fillVector
-//	adds all values in filler to fillMe
+//	adds all values from begin up to end to fillMe
 //=================================================================================================
-template<typename ValueType>
-void Trie<ValueType>::fillVector(const std::vector<ValueType> &filler, std::vector<ValueType> &fillMe) const {
-	for (size_t i = 0; i < filler.size(); i++)
-		fillMe.push_back(filler[i]);
+template<typename ValueType, typename Alphabet, size_t KeyLength>
+void Trie<ValueType, Alphabet, KeyLength>::fillVector(const ValueType *begin, const ValueType *end, std::vector<ValueType> &fillMe) const {
+	fillMe.insert(fillMe.end(), begin, end);
+}
+
+//=================================================================================================
+//	void findRootBatch
+//	starts findBatchWithMismatches at root for the keys at the indices in order
+//=================================================================================================
+template<typename ValueType, typename Alphabet, size_t KeyLength>
+template<typename NodePtr>
+void Trie<ValueType, Alphabet, KeyLength>::findRootBatch(NodePtr root, const std::vector<std::string> &keys, const std::vector<size_t> &order, int maxMismatches, std::vector<std::vector<ValueType>> &results) const {
+	for (size_t i = 0; i < childCount(root); i++)
+		TRIE_PREFETCH(child(root, i));
+
+	for (size_t i = 0; i < childCount(root); i++) {
+		std::vector<Cursor> cursors;	// the first char must always match exactly
+		for (size_t j = 0; j < order.size(); j++) {
+			if (keys[order[j]][0] == child(root, i)->id)
+				cursors.push_back(Cursor{ order[j], maxMismatches });
+		}
+		if (!cursors.empty())
+			findNodeBatch(child(root, i), 1, keys, cursors, results);
+	}
+}
+
+//=================================================================================================
+//	void findNodeBatch
+//	advances every cursor that is still alive at root by one char, visiting each child once for
+//	all of them. Values are added to each key's results in the same order find would add them
+//=================================================================================================
+template<typename ValueType, typename Alphabet, size_t KeyLength>
+template<typename NodePtr>
+void Trie<ValueType, Alphabet, KeyLength>::findNodeBatch(NodePtr root, size_t depth, const std::vector<std::string> &keys, const std::vector<Cursor> &cursors, std::vector<std::vector<ValueType>> &results) const {
+	std::vector<Cursor> live;	// cursors whose keys continue below root
+	for (size_t i = 0; i < cursors.size(); i++) {
+		if (depth == keySize(keys[cursors[i].keyIndex]))	// reached end of key so add its vals
+			fillVector(valuesBegin(root), valuesEnd(root), results[cursors[i].keyIndex]);
+		else
+			live.push_back(cursors[i]);
+	}
+	if (live.empty())
+		return;
+
+	// start fetching every child before descending so their loads overlap
+	for (size_t i = 0; i < childCount(root); i++)
+		TRIE_PREFETCH(child(root, i));
+
+	for (size_t i = 0; i < childCount(root); i++) {
+		NodePtr next = child(root, i);
+		std::vector<Cursor> nextCursors;
+		for (size_t j = 0; j < live.size(); j++) {
+			if (keys[live[j].keyIndex][depth] == next->id)	// char matches so keep going as is
+				nextCursors.push_back(live[j]);
+			else if (live[j].mismatchesLeft > 0)	// spend one mismatch on this child
+				nextCursors.push_back(Cursor{ live[j].keyIndex, live[j].mismatchesLeft - 1 });
+		}
+		if (!nextCursors.empty())
+			findNodeBatch(next, depth + 1, keys, nextCursors, results);
+	}
 }
 
 #endif // TRIE_INCLUDED
@@ -4,6 +4,14 @@
 #include <fstream>
 #include <string>
 #include <vector>
+#include <sstream>
+#include <chrono>
+#include <thread>
+#include <memory>
+#include <algorithm>
+#include <mutex>
+#include <condition_variable>
+#include <cstdio>
 #include <cctype>
 #include <cstdlib>
 using namespace std;
@@ -58,27 +66,24 @@ void addOneGenomeManually(GenomeMatcher* library)
 		cout << "Sequence must not be empty." << endl;
 		return;
 	}
-	if (sequence.find_first_not_of("ACGTNacgtn") != string::npos)
+	if (!Genome::normalizeSequence(sequence))
 	{
 		cout << "Invalid character in DNA sequence." << endl;
 		return;
 	}
-	for (char ch : sequence)
-		ch = toupper(ch);
 	library->addGenome(Genome(name, sequence));
 }
 
-bool loadFile(string filename, vector<Genome>& genomes)
+bool loadFile(string filename, vector<Genome>& genomes, ostream& log = cout)
 {
-	ifstream inputf(filename);
-	if (!inputf)
+	if (!ifstream(filename))
 	{
-		cout << "Cannot open file: " << filename << endl;
+		log << "Cannot open file: " << filename << endl;
 		return false;
 	}
-	if (!Genome::load(inputf, genomes))
+	if (!Genome::loadFile(filename, genomes))
 	{
-		cout << "Improperly formatted file: " << filename << endl;
+		log << "Improperly formatted file: " << filename << endl;
 		return false;
 	}
 	return true;
@@ -102,18 +107,71 @@ void loadOneDataFile(GenomeMatcher* library)
 	cout << "Successfully loaded " << genomes.size() << " genomes." << endl;
 }
 
-void loadProvidedFiles(GenomeMatcher* library)
+struct ProvidedFileLoad
 {
-	for (const string& f : providedFiles)
+	size_t genomeCount = 0;
+	bool ok = false;
+	string error;
+	double parseSeconds = 0;
+	double indexSeconds = 0;
+};
+
+// Splits the provided files into one run of consecutive files per hardware
+// thread.  Each thread parses and indexes its run into a library of its own,
+// made by library's createEmptyCopy so that it indexes genomes with library's
+// options, and those are merged into library in file order, so the genomes
+// end up in the same order as if the files were loaded one after another.  A
+// library that masks k-mers cannot take over another's index, so it indexes
+// the genomes again as they are merged.
+void loadProvidedFiles(GenomeMatcher* library, ostream& log = cout)
+{
+	const size_t numFiles = sizeof(providedFiles) / sizeof(providedFiles[0]);
+	size_t numWorkers = max<size_t>(1, min<size_t>(numFiles, thread::hardware_concurrency()));
+	vector<ProvidedFileLoad> loads(numFiles);
+	vector<unique_ptr<GenomeMatcher>> parts(numWorkers);
+	for (size_t w = 0; w < numWorkers; w++)
+		parts[w].reset(library->createEmptyCopy());
+	vector<thread> workers;
+	for (size_t w = 0; w < numWorkers; w++)
 	{
-		vector<Genome> genomes;
-		if (loadFile(PROVIDED_DIR + "/" + f, genomes))
+		workers.emplace_back([&loads, &parts, w, numWorkers, numFiles]()
 		{
-			for (const auto& g : genomes)
-				library->addGenome(g);
-			cout << "Loaded " << genomes.size() << " genomes from " << f << endl;
-		}
+			for (size_t i = w * numFiles / numWorkers; i < (w + 1) * numFiles / numWorkers; i++)
+			{
+				ProvidedFileLoad& load = loads[i];
+				auto start = chrono::steady_clock::now();
+				vector<Genome> genomes;
+				ostringstream error;
+				load.ok = loadFile(PROVIDED_DIR + "/" + providedFiles[i], genomes, error);
+				load.error = error.str();
+				auto parsed = chrono::steady_clock::now();
+				load.parseSeconds = chrono::duration<double>(parsed - start).count();
+				if (!load.ok)
+					continue;
+				for (const auto& g : genomes)
+					parts[w]->addGenome(g);
+				load.genomeCount = genomes.size();
+				load.indexSeconds = chrono::duration<double>(chrono::steady_clock::now() - parsed).count();
+			}
+		});
+	}
+	for (thread& t : workers)
+		t.join();
+
+	for (size_t i = 0; i < numFiles; i++)
+	{
+		if (!loads[i].ok)
+			log << loads[i].error;
+		else
+			log << "Loaded " << loads[i].genomeCount << " genomes from " << providedFiles[i]
+				<< " (parsed in " << loads[i].parseSeconds << "s, indexed in "
+				<< loads[i].indexSeconds << "s)" << endl;
 	}
+	auto start = chrono::steady_clock::now();
+	for (size_t w = 0; w < numWorkers; w++)
+		library->addGenomesFrom(*parts[w]);
+	log << "Merged " << numWorkers << " indexes in "
+		<< chrono::duration<double>(chrono::steady_clock::now() - start).count() << "s" << endl;
 }
 
 void findGenome(GenomeMatcher* library, bool exactMatch)
@@ -259,8 +317,464 @@ void showMenu()
 	cout << "         e - find matches exactly           q - quit" << endl;
 }
 
-int main()
+// ---------------------------------------------------------------------------
+// Batch mode
+//
+// Running the harness with arguments skips the menu. The library is built
+// once from the --load/--provided data and every query from --commands files
+// and --query flags is run against it, in order. Each query is one line:
+//
+//   e SEQUENCE MINLENGTH           find exact matches
+//   s SEQUENCE MINLENGTH           find matches and SNiPs
+//   r SEQUENCE PERCENT e|s         find related genomes of a sequence
+//   f FILENAME PERCENT e|s         find related genomes of each genome in a file
+//   l FILENAME                     load one more data file
+//
+// Blank lines and lines starting with # are ignored. Results are written to
+// --output (default standard output) as TSV with one row per match, or as one
+// JSON object per query with --format json. Messages go to standard error.
+// --cache N keeps the results of the last N distinct e and s queries so that
+// repeated ones are answered without searching again. --freeze compresses the
+// index once the --provided and --load files are in, so it takes less memory;
+// an l command unpacks it again.
+// ---------------------------------------------------------------------------
+
+struct BatchOptions
+{
+	int minSearchLength = 10;
+	bool loadProvided = false;
+	vector<string> dataFiles;
+	vector<string> commandFiles;
+	vector<string> queries;
+	string outputFile;
+	bool json = false;
+	int cacheCapacity = 0;
+	bool freeze = false;
+	string matrixFile;
+	bool matrixSnps = false;
+	int threads = 0;
+};
+
+struct BatchRow
+{
+	string genomeName;
+	int length = -1;
+	int position = -1;
+	double percent = -1;
+};
+
+void batchUsage()
+{
+	cerr << "usage: Project4 [--k LENGTH] [--provided] [--load FILE]... [--commands FILE|-]..." << endl;
+	cerr << "                [--query \"COMMAND\"]... [--output FILE] [--format tsv|json] [--cache N]" << endl;
+	cerr << "                [--freeze] [--matrix FILE [--matrix-snps] [--threads N]]" << endl;
+}
+
+bool parseBatchOptions(int argc, char* argv[], BatchOptions& opts)
+{
+	for (int i = 1; i < argc; i++)
+	{
+		string arg = argv[i];
+		bool hasValue = i + 1 < argc;
+		if (arg == "--k" && hasValue)
+			opts.minSearchLength = atoi(argv[++i]);
+		else if (arg == "--provided")
+			opts.loadProvided = true;
+		else if (arg == "--load" && hasValue)
+			opts.dataFiles.push_back(argv[++i]);
+		else if (arg == "--commands" && hasValue)
+			opts.commandFiles.push_back(argv[++i]);
+		else if (arg == "--query" && hasValue)
+			opts.queries.push_back(argv[++i]);
+		else if (arg == "--output" && hasValue)
+			opts.outputFile = argv[++i];
+		else if (arg == "--format" && hasValue && (string(argv[i + 1]) == "tsv" || string(argv[i + 1]) == "json"))
+			opts.json = (string(argv[++i]) == "json");
+		else if (arg == "--cache" && hasValue)
+			opts.cacheCapacity = atoi(argv[++i]);
+		else if (arg == "--freeze")
+			opts.freeze = true;
+		else if (arg == "--matrix" && hasValue)
+			opts.matrixFile = argv[++i];
+		else if (arg == "--matrix-snps")
+			opts.matrixSnps = true;
+		else if (arg == "--threads" && hasValue)
+			opts.threads = atoi(argv[++i]);
+		else
+		{
+			batchUsage();
+			return false;
+		}
+	}
+	if (opts.minSearchLength < 3 || opts.minSearchLength > 100)
+	{
+		cerr << "Invalid prefix size." << endl;
+		return false;
+	}
+	return true;
+}
+
+string jsonQuote(const string& s)
+{
+	string out = "\"";
+	for (char ch : s)
+	{
+		if (ch == '"' || ch == '\\')
+			out += '\\';
+		if (static_cast<unsigned char>(ch) >= 0x20)
+			out += ch;
+	}
+	return out + "\"";
+}
+
+string tsvField(string s)
+{
+	for (char& ch : s)
+	{
+		if (ch == '\t' || ch == '\n' || ch == '\r')
+			ch = ' ';
+	}
+	return s;
+}
+
+void writeBatchResult(ostream& out, bool json, int queryNum, const string& command, const string& input,
+	const string& error, double seconds, const vector<BatchRow>& rows)
+{
+	if (json)
+	{
+		out << "{\"query\":" << queryNum << ",\"command\":" << jsonQuote(command)
+			<< ",\"input\":" << jsonQuote(input) << ",\"ok\":" << (error.empty() ? "true" : "false");
+		if (!error.empty())
+			out << ",\"error\":" << jsonQuote(error);
+		out << ",\"seconds\":" << seconds << ",\"results\":[";
+		for (size_t i = 0; i < rows.size(); i++)
+		{
+			out << (i == 0 ? "" : ",") << "{\"genome\":" << jsonQuote(rows[i].genomeName);
+			if (rows[i].length >= 0)
+				out << ",\"length\":" << rows[i].length << ",\"position\":" << rows[i].position;
+			if (rows[i].percent >= 0)
+				out << ",\"percent\":" << rows[i].percent;
+			out << "}";
+		}
+		out << "]}\n";
+		return;
+	}
+
+	string prefix = to_string(queryNum) + "\t" + command + "\t" + tsvField(input) + "\t"
+		+ (error.empty() ? "ok" : tsvField(error)) + "\t";
+	ostringstream secondsText;
+	secondsText << seconds;
+	prefix += secondsText.str() + "\t";
+	if (rows.empty())
+		out << prefix << "\t\t\t\n";
+	for (const auto& row : rows)
+	{
+		out << prefix << tsvField(row.genomeName) << "\t";
+		if (row.length >= 0)
+			out << row.length << "\t" << row.position;
+		else
+			out << "\t";
+		out << "\t";
+		if (row.percent >= 0)
+			out << row.percent;
+		out << "\n";
+	}
+}
+
+void addRelatedRows(const vector<GenomeMatch>& matches, const string& queryName, vector<BatchRow>& rows)
+{
+	for (const auto& m : matches)
+	{
+		BatchRow row;
+		row.genomeName = queryName.empty() ? m.genomeName : queryName + " -> " + m.genomeName;
+		row.percent = m.percentMatch;
+		rows.push_back(row);
+	}
+}
+
+// Removes the last word of text and returns it.
+string popLastWord(string& text)
+{
+	size_t end = text.find_last_not_of(" \t\r");
+	if (end == string::npos)
+	{
+		text.clear();
+		return "";
+	}
+	size_t start = text.find_last_of(" \t", end);
+	start = (start == string::npos) ? 0 : start + 1;
+	string word = text.substr(start, end + 1 - start);
+	text.erase(start);
+	return word;
+}
+
+// Runs one query line and writes its result.  Returns false if the line was
+// malformed or the query could not be run.
+bool runBatchQuery(GenomeMatcher* library, const string& line, int queryNum, ostream& out, bool json)
+{
+	istringstream words(line);
+	string command, input, param1, param2;
+	words >> command >> input >> param1 >> param2;
+	if (command == "f" || command == "l")
+	{
+		// file names run to the end of the line (minus f's two parameters),
+		// so they may contain spaces
+		string rest = line.substr(line.find(command) + 1);
+		if (command == "f")
+		{
+			param2 = popLastWord(rest);
+			param1 = popLastWord(rest);
+		}
+		size_t first = rest.find_first_not_of(" \t");
+		size_t last = rest.find_last_not_of(" \t\r");
+		input = (first == string::npos) ? "" : rest.substr(first, last + 1 - first);
+	}
+	string error;
+	vector<BatchRow> rows;
+
+	auto start = chrono::steady_clock::now();
+	int minLength = library->minimumSearchLength();
+	if ((command == "e" || command == "s") && !input.empty() && !param1.empty())
+	{
+		int minMatchLength = atoi(param1.c_str());
+		vector<DNAMatch> matches;
+		if ((int)input.size() < minLength)
+			error = "DNA sequence length must be at least " + to_string(minLength);
+		else if (minMatchLength > (int)input.size())
+			error = "Minimum match length must be at least the sequence length.";
+		else
+			library->findGenomesWithThisDNA(input, minMatchLength, command == "e", matches);
+		for (const auto& m : matches)
+		{
+			BatchRow row;
+			row.genomeName = m.genomeName;
+			row.length = m.length;
+			row.position = m.position;
+			rows.push_back(row);
+		}
+	}
+	else if ((command == "r" || command == "f") && !input.empty() && !param1.empty()
+		&& (param2 == "e" || param2 == "s"))
+	{
+		double pct = atof(param1.c_str());
+		bool exactMatchOnly = (param2 == "e");
+		vector<Genome> genomes;
+		if (pct < 0 || pct > 100)
+			error = "Percentage must be in the range 0 to 100.";
+		else if (command == "r")
+		{
+			if ((int)input.size() < minLength)
+				error = "DNA sequence length must be at least " + to_string(minLength);
+			else
+				genomes.push_back(Genome("x", input));
+		}
+		else if (!loadFile(input, genomes, cerr))
+			error = "Cannot load file: " + input;
+		for (const auto& g : genomes)
+		{
+			vector<GenomeMatch> matches;
+			library->findRelatedGenomes(g, 2 * minLength, exactMatchOnly, pct, matches);
+			addRelatedRows(matches, command == "f" ? g.name() : "", rows);
+		}
+	}
+	else if (command == "l" && !input.empty())
+	{
+		vector<Genome> genomes;
+		if (!loadFile(input, genomes, cerr))
+			error = "Cannot load file: " + input;
+		for (const auto& g : genomes)
+			library->addGenome(g);
+	}
+	else
+		error = "Invalid command";
+	double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+	writeBatchResult(out, json, queryNum, command, line, error, seconds, rows);
+	return error.empty();
+}
+
+// Writes the all-vs-all similarity matrix of the library to out as TSV: a
+// header of genome names, then one row per genome giving the percentage of its
+// fragments (2 * minSearchLength bases, as the r and f commands use) that
+// match each genome.  Query genomes are handed out to numThreads threads one
+// at a time; each thread reuses its own percentage and text buffers, and rows
+// are written in library order as soon as every earlier row is out, so at
+// most a few rows per thread are ever held in memory.
+size_t writeSimilarityMatrix(const GenomeMatcher& library, bool exactMatchOnly, int numThreads, ostream& out)
+{
+	const vector<Genome> genomes = library.genomes();
+	const int fragmentLength = 2 * library.minimumSearchLength();
+	const size_t window = 4 * numThreads;	// rows that may be claimed ahead of the next one written
+
+	out << "query";
+	for (const auto& g : genomes)
+		out << "\t" << tsvField(g.name());
+	out << "\n";
+
+	mutex m;
+	condition_variable rowWritten;
+	size_t nextQuery = 0;
+	size_t nextToWrite = 0;
+	vector<string> pending(window);	// finished rows waiting for earlier ones, by row % window
+	vector<bool> isPending(window, false);
+
+	auto work = [&]()
+	{
+		vector<double> percents;
+		string row;
+		char number[32];
+		for (;;)
+		{
+			size_t q;
+			{
+				unique_lock<mutex> lock(m);
+				rowWritten.wait(lock, [&]() { return nextQuery >= genomes.size() || nextQuery < nextToWrite + window; });
+				if (nextQuery >= genomes.size())
+					return;
+				q = nextQuery++;
+			}
+
+			row = tsvField(genomes[q].name());
+			bool ok = library.findRelatedPercentages(genomes[q], fragmentLength, exactMatchOnly, percents);
+			for (size_t i = 0; i < genomes.size(); i++)
+			{
+				row += '\t';
+				if (ok)
+				{
+					snprintf(number, sizeof(number), "%g", percents[i]);
+					row += number;
+				}
+			}
+			row += '\n';
+
+			lock_guard<mutex> lock(m);
+			if (q != nextToWrite)
+			{
+				pending[q % window].swap(row);
+				isPending[q % window] = true;
+				continue;
+			}
+			out << row;
+			nextToWrite++;
+			while (isPending[nextToWrite % window])
+			{
+				out << pending[nextToWrite % window];
+				isPending[nextToWrite % window] = false;
+				nextToWrite++;
+			}
+			rowWritten.notify_all();
+		}
+	};
+
+	vector<thread> workers;
+	for (int t = 1; t < numThreads; t++)
+		workers.emplace_back(work);
+	work();
+	for (thread& t : workers)
+		t.join();
+	return genomes.size();
+}
+
+int runBatch(int argc, char* argv[])
 {
+	BatchOptions opts;
+	if (!parseBatchOptions(argc, argv, opts))
+		return 1;
+
+	ofstream outputf;
+	if (!opts.outputFile.empty())
+	{
+		outputf.open(opts.outputFile);
+		if (!outputf)
+		{
+			cerr << "Cannot open output file: " << opts.outputFile << endl;
+			return 1;
+		}
+	}
+	ostream& out = opts.outputFile.empty() ? cout : outputf;
+
+	ofstream matrixf;
+	if (!opts.matrixFile.empty())
+	{
+		matrixf.open(opts.matrixFile);
+		if (!matrixf)
+		{
+			cerr << "Cannot open matrix file: " << opts.matrixFile << endl;
+			return 1;
+		}
+	}
+
+	GenomeMatcher library(opts.minSearchLength);
+	library.setResultCacheCapacity(opts.cacheCapacity);
+	if (opts.loadProvided)
+		loadProvidedFiles(&library, cerr);
+	for (const string& f : opts.dataFiles)
+	{
+		vector<Genome> genomes;
+		if (!loadFile(f, genomes, cerr))
+			return 1;
+		for (const auto& g : genomes)
+			library.addGenome(g);
+		cerr << "Loaded " << genomes.size() << " genomes from " << f << endl;
+	}
+	if (opts.freeze)
+		library.freezeIndex();
+
+	if (!opts.json)
+		out << "query\tcommand\tinput\tstatus\tseconds\tgenome\tlength\tposition\tpercent\n";
+
+	int queryNum = 0;
+	int failures = 0;
+	auto runLine = [&](const string& line)
+	{
+		size_t first = line.find_first_not_of(" \t\r");
+		if (first == string::npos || line[first] == '#')
+			return;
+		if (!runBatchQuery(&library, line.substr(first), ++queryNum, out, opts.json))
+			failures++;
+	};
+	for (const string& f : opts.commandFiles)
+	{
+		ifstream commandf;
+		if (f != "-")
+		{
+			commandf.open(f);
+			if (!commandf)
+			{
+				cerr << "Cannot open command file: " << f << endl;
+				return 1;
+			}
+		}
+		istream& commands = (f == "-") ? cin : commandf;
+		string line;
+		while (getline(commands, line))
+			runLine(line);
+	}
+	for (const string& q : opts.queries)
+		runLine(q);
+
+	out.flush();
+	cerr << queryNum << " queries run, " << failures << " failed." << endl;
+	if (matrixf.is_open())
+	{
+		int numThreads = opts.threads > 0 ? opts.threads : max(1, (int)thread::hardware_concurrency());
+		auto start = chrono::steady_clock::now();
+		size_t rows = writeSimilarityMatrix(library, !opts.matrixSnps, numThreads, matrixf);
+		matrixf.flush();
+		cerr << "Wrote " << rows << " x " << rows << " similarity matrix to " << opts.matrixFile << " in "
+			<< chrono::duration<double>(chrono::steady_clock::now() - start).count() << "s on "
+			<< numThreads << " threads." << endl;
+	}
+	if (opts.cacheCapacity > 0)
+		cerr << "Result cache: " << library.resultCacheHits() << " hits, " << library.resultCacheMisses() << " misses." << endl;
+	return failures == 0 ? 0 : 2;
+}
+
+int main(int argc, char* argv[])
+{
+	if (argc > 1)
+		return runBatch(argc, argv);
+
 	const int defaultMinSearchLength = 10;
 
 	cout << "Welcome to the Gee-nomics test harness!" << endl;
@@ -11,13 +11,25 @@ class Genome
 {
 public:
 	Genome(const std::string& nm, const std::string& sequence);
+	Genome(const std::string& nm, std::string&& sequence);
 	~Genome();
+	  // Copies share the original's sequence, which is never modified.  A
+	  // moved-from Genome may only be assigned to or destroyed.
 	Genome(const Genome& other);
 	Genome& operator=(const Genome& rhs);
+	Genome(Genome&& other) noexcept;
+	Genome& operator=(Genome&& rhs) noexcept;
 	static bool load(std::istream& genomeSource, std::vector<Genome>& genomes);
+	static bool loadFile(const std::string& filename, std::vector<Genome>& genomes);
+	static bool normalizeSequence(std::string& sequence);
 	int length() const;
-	std::string name() const;
+	  // The name is interned: it stays valid for the life of the program, and
+	  // genomes with equal names return the same string.
+	const std::string& name() const;
 	bool extract(int position, int length, std::string& fragment) const;
+	  // The whole sequence, without copying it.  It stays valid and unchanged
+	  // for as long as this genome or any copy of it exists.
+	const std::string& sequence() const;
 
 private:
 	GenomeImpl* m_impl;
@@ -28,6 +40,9 @@ struct DNAMatch
 	std::string genomeName;
 	int length;
 	int position;
+	  // True if the fragment's reverse complement matched, starting at position
+	  // on the genome as given.
+	bool reverseStrand;
 };
 
 struct GenomeMatch
@@ -37,22 +52,112 @@ struct GenomeMatch
 };
 
 class GenomeMatcherImpl;
+class ConcurrentGenomeMatcherImpl;
 
 class GenomeMatcher
 {
 public:
-	GenomeMatcher(int minSearchLength);
+	  // If concurrent is true, any number of threads may call the const
+	  // functions while another thread calls addGenome; each query sees the
+	  // library as it was before or after each addGenome, never in between.
+	  // This roughly doubles the memory used by the index.
+	GenomeMatcher(int minSearchLength, int sketchScale = 0, bool concurrent = false);
 	~GenomeMatcher();
+	  // Only windows of the genome made of uppercase A, C, G, T and N are
+	  // indexed, so a genome built from other text should be passed through
+	  // Genome::normalizeSequence first.
 	void addGenome(const Genome& genome);
+	  // Adds other's genomes, in the order they were added to other, as if
+	  // each were passed to addGenome, and leaves other empty.  If other is
+	  // not concurrent and both were built with the same options and without
+	  // setMaxSeedOccurrences, other's index is moved into this one instead
+	  // of being rebuilt (a concurrent library copies it into one of its two
+	  // indexes), so libraries built on separate threads can be combined
+	  // cheaply.
+	void addGenomesFrom(GenomeMatcher& other);
+	  // Returns a new library with no genomes, never concurrent, that indexes
+	  // genomes as this one now would: with the same minSearchLength and
+	  // sketchScale, and the same setMaxIndexedNs, setMaxSeedOccurrences and
+	  // setRelatedPrefilter settings.  A library filled on another thread
+	  // from it can be passed to addGenomesFrom.  The caller deletes it.
+	GenomeMatcher* createEmptyCopy() const;
 	int minimumSearchLength() const;
-	bool findGenomesWithThisDNA(const std::string& fragment, int minimumLength, bool exactMatchOnly, std::vector<DNAMatch>& matches) const;
-	bool findRelatedGenomes(const Genome& query, int fragmentMatchLength, bool exactMatchOnly, double matchPercentThreshold, std::vector<GenomeMatch>& results) const;
+	  // Each genome gets its longest match; of equally long ones, the match in
+	  // the earliest added genome with that name, at the earliest position.
+	  // If bothStrands is true, the fragment's reverse complement is searched
+	  // for in the same pass, and a genome gets its longest match on either
+	  // strand (the forward one if they tie).
+	bool findGenomesWithThisDNA(const std::string& fragment, int minimumLength, bool exactMatchOnly, std::vector<DNAMatch>& matches, bool bothStrands = false) const;
+	bool findGenomesWithMismatches(const std::string& fragment, int minimumLength, int maxMismatches, std::vector<DNAMatch>& matches) const;
+	bool findGenomesWithThisDNABatch(const std::vector<std::string>& fragments, int minimumLength, bool exactMatchOnly, std::vector<std::vector<DNAMatch>>& matches) const;
+	bool findGenomesWithMismatchesBatch(const std::vector<std::string>& fragments, int minimumLength, int maxMismatches, std::vector<std::vector<DNAMatch>>& matches) const;
+	  // If bothStrands is true, a fragment of the query also counts toward a
+	  // genome its reverse complement matches, once per fragment.
+	bool findRelatedGenomes(const Genome& query, int fragmentMatchLength, bool exactMatchOnly, double matchPercentThreshold, std::vector<GenomeMatch>& results, bool bothStrands = false) const;
+	bool findRelatedGenomesSketch(const Genome& query, int fragmentMatchLength, bool exactMatchOnly, double matchPercentThreshold, int verifyTop, std::vector<GenomeMatch>& results) const;
+	  // Sets percents[i] to the percentage of query's fragments that match the
+	  // i-th genome added, counted as findRelatedGenomes counts them but with
+	  // no threshold and without the prefilter, so one call gives a full row
+	  // of an all-vs-all matrix.  percents is resized to the number of
+	  // genomes.  Returns false, leaving percents unchanged, if
+	  // fragmentMatchLength is less than minSearchLength or query is shorter
+	  // than one fragment.
+	bool findRelatedPercentages(const Genome& query, int fragmentMatchLength, bool exactMatchOnly, std::vector<double>& percents, bool bothStrands = false) const;
+	  // Copies of the genomes, in the order they were added.
+	std::vector<Genome> genomes() const;
+	  // Remembers the results of up to capacity recent findGenomesWithThisDNA
+	  // queries (none by default).  addGenome and changing the capacity empty
+	  // the cache.  The counts are of queries answered and not answered from
+	  // the cache while it was on.
+	void setResultCacheCapacity(int capacity);
+	long long resultCacheHits() const;
+	long long resultCacheMisses() const;
+	  // Genomes added after this call do not index the windows of
+	  // minSearchLength bases that hold more than maxNs Ns (a negative maxNs,
+	  // the default, indexes every window).  A match whose first
+	  // minSearchLength genome bases hold more than maxNs Ns is then never
+	  // found, whatever the fragment; other matches, including ones with Ns
+	  // past the seed or in the fragment, are found as before.
+	void setMaxIndexedNs(int maxNs);
+	  // Genomes added after this call mask any k-mer (window of minSearchLength
+	  // bases) found in more than maxOccurrences places (0, the default, masks
+	  // none).  Masked k-mers are never used as seeds, which bounds the work of
+	  // each query.  A fragment that starts with a masked k-mer is seeded from
+	  // maxMismatches + 1 side-by-side unmasked k-mers in its first
+	  // minimumLength bases, and gets no matches if there are none.  Matches
+	  // whose first minSearchLength genome bases are masked are found only
+	  // that way.
+	void setMaxSeedOccurrences(int maxOccurrences);
+	  // findRelatedGenomes queries made after this call test a fragment of
+	  // fragmentMatchLength bases starting every stride bases of the query,
+	  // overlapping when stride is shorter, instead of back-to-back fragments
+	  // (0, the default).  The match percentage is then the share of these
+	  // fragments that match.
+	void setFragmentStride(int stride);
+	  // If sampleFragments is positive (0, the default, is off), genomes added
+	  // after this call also get a Bloom filter of their k-mers, about 10 bits
+	  // per base, and findRelatedGenomes first checks up to sampleFragments of
+	  // the query's fragments, spread evenly over it, against each genome's
+	  // filter.  Genomes that too few of them could match to pass
+	  // matchPercentThreshold are not searched.  Results are unchanged when
+	  // the query has no more fragments than sampleFragments; beyond that the
+	  // share is estimated from the sample, and a genome close to the threshold
+	  // may be left out.
+	void setRelatedPrefilter(int sampleFragments);
+	  // Compresses the index's lists of where each k-mer is found into a
+	  // read-only form, and lays out the tree of k-mers in flat arrays, for use
+	  // once every genome has been added.  Saves most of their memory when
+	  // k-mers are found in many places.  Queries give the same results.
+	  // Adding a genome afterward first unpacks the index again.
+	void freezeIndex();
 	// We prevent a GenomeMatcher object from being copied or assigned.
 	GenomeMatcher(const GenomeMatcher&) = delete;
 	GenomeMatcher& operator=(const GenomeMatcher&) = delete;
 
 private:
+	GenomeMatcher(GenomeMatcherImpl* impl);
 	GenomeMatcherImpl* m_impl;
+	ConcurrentGenomeMatcherImpl* m_concurrentImpl;
 };
 
 #endif // PROVIDED_INCLUDED
@@ -0,0 +1,714 @@
+#include "provided.h"
+#include "Trie.h"
+#include <algorithm>
+#include <atomic>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+using namespace std;
+
+// Checks behavior of the genome library that the harness and the benchmark do not exercise.
+// Prints each failed check to cerr and exits with 1 if any failed, 0 otherwise.
+//
+// usage: Tests
+
+int g_failures = 0;
+
+//=================================================================================================
+//	void check
+//	records a failure named what unless passed is true
+//=================================================================================================
+void check(bool passed, const string &what) {
+	if (!passed) {
+		cerr << "FAILED: " << what << endl;
+		g_failures++;
+	}
+}
+
+//=================================================================================================
+//	string randomDna
+//	returns length random bases drawn from A, C, G and T
+//=================================================================================================
+string randomDna(mt19937 &rng, int length) {
+	string dna(length, 'A');
+	for (int i = 0; i < length; i++)
+		dna[i] = "ACGT"[rng() % 4];
+	return dna;
+}
+
+//=================================================================================================
+//	bool sameMatches
+//	returns true if a and b hold the same matches in the same order
+//=================================================================================================
+bool sameMatches(const vector<DNAMatch> &a, const vector<DNAMatch> &b) {
+	if (a.size() != b.size())
+		return false;
+	for (size_t i = 0; i < a.size(); i++) {
+		if (a[i].genomeName != b[i].genomeName || a[i].length != b[i].length || a[i].position != b[i].position
+			|| a[i].reverseStrand != b[i].reverseStrand)
+			return false;
+	}
+	return true;
+}
+
+//=================================================================================================
+//	vector<DNAMatch> byName
+//	returns matches sorted by genome name, for comparing results whose order is not specified
+//=================================================================================================
+vector<DNAMatch> byName(vector<DNAMatch> matches) {
+	sort(matches.begin(), matches.end(), [](const DNAMatch &a, const DNAMatch &b) { return a.genomeName < b.genomeName; });
+	return matches;
+}
+
+//=================================================================================================
+//	class NaiveLibrary
+//	what findGenomesWithMismatches should return, worked out by comparing the fragment with every
+//	place of every genome instead of using an index. Each genome is added with the Ns limit it was
+//	indexed with, and k-mers found in more than maxOccurrences indexed places are masked
+//=================================================================================================
+class NaiveLibrary
+{
+public:
+	NaiveLibrary(int minSearchLength, int maxOccurrences) : m_k(minSearchLength), m_maxOccurrences(maxOccurrences) {}
+	void addGenome(const Genome &genome, int maxNs);
+	vector<DNAMatch> find(const string &fragment, int minimumLength, int maxMismatches) const;
+private:
+	int m_k;
+	int m_maxOccurrences;	// 0 to mask none
+	vector<Genome> m_genomes;
+	vector<int> m_maxNs;	// the Ns limit each genome was added with, -1 for none
+	map<string, int> m_occurrences;	// how many indexed places each k-mer is found in
+
+	bool fitsNs(const string &kmer, int maxNs) const { return maxNs < 0 || count(kmer.begin(), kmer.end(), 'N') <= maxNs; }
+	bool isMasked(const string &kmer) const;
+	bool isIndexedEverywhere(const string &kmer) const;
+	bool isIndexedIn(const string &kmer, size_t genomeIndex) const;
+};
+
+//=================================================================================================
+//	void addGenome
+//	adds genome and counts its k-mers that fit maxNs
+//=================================================================================================
+void NaiveLibrary::addGenome(const Genome &genome, int maxNs) {
+	m_genomes.push_back(genome);
+	m_maxNs.push_back(maxNs);
+	string kmer;
+	for (int i = 0; genome.extract(i, m_k, kmer); i++) {
+		if (fitsNs(kmer, maxNs))
+			m_occurrences[kmer]++;
+	}
+}
+
+//=================================================================================================
+//	bool isMasked / isIndexedEverywhere / isIndexedIn
+//	whether kmer is masked, is indexed wherever any genome holds it, and is indexed where the
+//	genome at genomeIndex holds it
+//=================================================================================================
+bool NaiveLibrary::isMasked(const string &kmer) const {
+	map<string, int>::const_iterator found = m_occurrences.find(kmer);
+	return m_maxOccurrences > 0 && found != m_occurrences.end() && found->second > m_maxOccurrences;
+}
+
+bool NaiveLibrary::isIndexedEverywhere(const string &kmer) const {
+	for (size_t i = 0; i < m_genomes.size(); i++) {
+		if (!isIndexedIn(kmer, i))
+			return false;
+	}
+	return true;
+}
+
+bool NaiveLibrary::isIndexedIn(const string &kmer, size_t genomeIndex) const {
+	return !isMasked(kmer) && fitsNs(kmer, m_maxNs[genomeIndex]);
+}
+
+//=================================================================================================
+//	vector<DNAMatch> find
+//	returns the longest match per genome, the earliest if several are longest, of at least
+//	minimumLength chars with up to maxMismatches SNiPs after the first char, starting at a place
+//	whose k-mer is indexed. A fragment whose first k-mer is masked is seeded from a run of
+//	maxMismatches + 1 side by side k-mers in its first minimumLength chars that are indexed
+//	everywhere, and may then also match where the genome's k-mer is masked. Only holds when
+//	minimumLength leaves at most MAX_PLANNED_RUNS places for such a run, so all of them are tried
+//=================================================================================================
+vector<DNAMatch> NaiveLibrary::find(const string &fragment, int minimumLength, int maxMismatches) const {
+	vector<DNAMatch> matches;
+	if ((int)fragment.size() < minimumLength || minimumLength < m_k)
+		return matches;
+
+	bool firstMasked = isMasked(fragment.substr(0, m_k));
+	if (firstMasked) {
+		bool seeded = false;
+		for (int shift = 0; shift + (maxMismatches + 1) * m_k <= minimumLength && !seeded; shift++) {
+			seeded = true;
+			for (int j = 0; j <= maxMismatches; j++)
+				seeded = seeded && isIndexedEverywhere(fragment.substr(shift + j * m_k, m_k));
+		}
+		if (!seeded)
+			return matches;
+	}
+
+	for (size_t g = 0; g < m_genomes.size(); g++) {
+		const string &sequence = m_genomes[g].sequence();
+		DNAMatch best = { m_genomes[g].name(), 0, 0, false };
+		for (int p = 0; p + m_k <= (int)sequence.size(); p++) {
+			string window = sequence.substr(p, m_k);
+			if (window[0] != fragment[0] || !(isIndexedIn(window, g) || (firstMasked && isMasked(window))))
+				continue;
+			int length = 0;
+			for (int mismatches = 0; length < (int)fragment.size() && p + length < (int)sequence.size(); length++) {
+				if (fragment[length] != sequence[p + length] && ++mismatches > maxMismatches)
+					break;
+			}
+			if (length >= minimumLength && length > best.length) {
+				best.length = length;
+				best.position = p;
+			}
+		}
+		if (best.length > 0)
+			matches.push_back(best);
+	}
+	return matches;
+}
+
+//=================================================================================================
+//	void testTrieAlphabet
+//	a DnaAlphabet trie leaves out keys with chars it has no slot for and still finds the rest
+//=================================================================================================
+void testTrieAlphabet() {
+	Trie<int, DnaAlphabet> trie;
+	check(trie.insert("acgt", 1) == 0, "lowercase key is not inserted");
+	check(trie.insert("ACRT", 2) == 0, "key with an IUPAC code is not inserted");
+	check(trie.insert("ACGT", 3) == 1, "uppercase key is inserted");
+	check(trie.insert("ACGN", 4) == 1, "key with an N is inserted");
+	check(trie.find("acgt", true).empty(), "lowercase key is not found");
+	check(trie.find("ACRT", true).empty(), "key with an IUPAC code is not found");
+	check(trie.find("ACRT", false).size() == 1, "an IUPAC code in a search key counts as a mismatch");
+	vector<int> found = trie.find("ACGT", true);
+	check(found.size() == 1 && found[0] == 3, "uppercase key is found");
+	check(trie.find("ACGA", false).size() == 2, "keys one mismatch away are found");
+
+	trie.freeze();
+	check(trie.find("acgt", false).empty(), "lowercase key is not found once frozen");
+	check(trie.insert("acga", 5) == 0, "lowercase key is not inserted into a frozen trie");
+	check(trie.find("ACGT", true).size() == 1, "uppercase key is found after a rejected insert");
+}
+
+//=================================================================================================
+//	void testTrieKeyLength
+//	a trie with a fixed KeyLength leaves out keys of any other length, and finding one of them
+//	finds nothing instead of reading past its end
+//=================================================================================================
+void testTrieKeyLength() {
+	Trie<int, DnaAlphabet, 4> trie;
+	check(trie.insert("ACG", 1) == 0, "key shorter than KeyLength is not inserted");
+	check(trie.insert("ACGTA", 2) == 0, "key longer than KeyLength is not inserted");
+	check(trie.insert("ACGT", 3) == 1, "key of KeyLength is inserted");
+	check(trie.find("ACG", false).empty(), "key shorter than KeyLength finds nothing");
+	check(trie.find("ACGTA", false).empty(), "key longer than KeyLength finds nothing");
+	check(trie.countWithMismatches("AC", 1) == 0, "short key counts nothing");
+	trie.removeValues("AC");
+	check(trie.find("ACGT", true).size() == 1, "removing a short key leaves the others");
+
+	vector<string> keys = { "ACG", "ACGT", "ACGA", "" };
+	vector<vector<int>> found;
+	trie.findBatch(keys, false, found);
+	check(found.size() == 4 && found[0].empty() && found[1].size() == 1 && found[2].size() == 1 && found[3].empty(),
+		"a batch finds only the keys of KeyLength");
+
+	trie.freeze();
+	check(trie.find("ACG", false).empty(), "short key finds nothing once frozen");
+	check(trie.find("ACGT", true).size() == 1, "key of KeyLength is found once frozen");
+}
+
+//=================================================================================================
+//	void testGenomeAlphabet
+//	a genome holding chars other than A, C, G, T and N can be added, its other windows are still
+//	indexed, and queries with those chars find nothing instead of failing
+//=================================================================================================
+void testGenomeAlphabet() {
+	for (int frozen = 0; frozen < 2; frozen++) {
+		GenomeMatcher library(4);
+		library.addGenome(Genome("low", "acgtacgtacgtRYacgt"));
+		library.addGenome(Genome("mixed", "ACGTRYACGTTTGCAAACGT"));
+		if (frozen)
+			library.freezeIndex();
+
+		string when = frozen ? " (frozen)" : "";
+		vector<DNAMatch> matches;
+		check(!library.findGenomesWithThisDNA("acgtacgt", 4, true, matches), "lowercase query finds nothing" + when);
+		matches.clear();
+		check(!library.findGenomesWithThisDNA("RYACGTTT", 4, false, matches), "query starting with an IUPAC code finds nothing" + when);
+		matches.clear();
+		check(library.findGenomesWithThisDNA("ACGTTTGCAA", 8, true, matches) && matches.size() == 1
+			&& matches[0].genomeName == "mixed" && matches[0].position == 6, "windows past the IUPAC run are found" + when);
+
+		vector<GenomeMatch> related;
+		check(library.findRelatedGenomes(Genome("q", "ACGTTTGCAAACGT"), 8, true, 0, related) && !related.empty()
+			&& related[0].genomeName == "mixed", "related genomes are found beside the IUPAC run" + when);
+	}
+}
+
+//=================================================================================================
+//	void testConcurrentCache
+//	several threads querying one library at once, with the result cache off and then on, each get
+//	the results a single thread gets, and with the cache off no query counts as a hit or a miss
+//=================================================================================================
+void testConcurrentCache() {
+	const int NUM_THREADS = 4;
+	mt19937 rng(36);
+	vector<Genome> genomes;
+	for (int i = 0; i < 6; i++)
+		genomes.push_back(Genome("g" + to_string(i), randomDna(rng, 5000)));
+	vector<string> fragments;
+	for (int i = 0; i < 200; i++) {
+		const Genome &genome = genomes[rng() % genomes.size()];
+		string fragment;
+		genome.extract(rng() % (genome.length() - 30), 12 + rng() % 18, fragment);
+		if (i % 2)
+			fragment[1 + rng() % (fragment.size() - 1)] = "ACGT"[rng() % 4];
+		fragments.push_back(fragment);
+	}
+
+	for (int concurrent = 0; concurrent < 2; concurrent++) {
+		GenomeMatcher library(8, 0, concurrent == 1);
+		for (size_t i = 0; i < genomes.size(); i++)
+			library.addGenome(genomes[i]);
+		vector<vector<DNAMatch>> expected(fragments.size());
+		for (size_t i = 0; i < fragments.size(); i++)
+			library.findGenomesWithThisDNA(fragments[i], 8, i % 3 == 0, expected[i]);
+
+		string mode = concurrent ? " (concurrent)" : "";
+		for (int capacity = 0; capacity <= 50; capacity += 50) {
+			library.setResultCacheCapacity(capacity);
+			long long lookupsBefore = library.resultCacheHits() + library.resultCacheMisses();
+			vector<int> wrong(NUM_THREADS, 0);
+			vector<thread> readers;
+			for (int t = 0; t < NUM_THREADS; t++) {
+				readers.emplace_back([&library, &fragments, &expected, &wrong, t]() {
+					for (size_t i = 0; i < fragments.size(); i++) {
+						size_t q = (i + t * 37) % fragments.size();	// each thread in its own order
+						vector<DNAMatch> matches;
+						library.findGenomesWithThisDNA(fragments[q], 8, q % 3 == 0, matches);
+						if (!sameMatches(matches, expected[q]))
+							wrong[t]++;
+					}
+				});
+			}
+			for (size_t t = 0; t < readers.size(); t++)
+				readers[t].join();
+
+			string cache = capacity == 0 ? " with the cache off" : " with the cache on";
+			for (int t = 0; t < NUM_THREADS; t++)
+				check(wrong[t] == 0, "each reader gets the single-thread results" + cache + mode);
+			long long lookups = library.resultCacheHits() + library.resultCacheMisses() - lookupsBefore;
+			if (capacity == 0)
+				check(lookups == 0, "no query uses the cache while it is off" + mode);
+			else
+				check(lookups == NUM_THREADS * (long long)fragments.size(), "every query uses the cache while it is on" + mode);
+		}
+	}
+}
+
+//=================================================================================================
+//	void testPlannedSeeds
+//	findGenomesWithMismatches, which seeds a fragment from its rarest k-mers when its first k-mer
+//	is common, finds what NaiveLibrary finds: without options, with masking, and with the Ns
+//	limit changed between genomes, live and frozen. A motif planted all over the genomes makes
+//	the fragments starting with it common enough to be planned, and its N puts it over the limit
+//	of only the genomes added last
+//=================================================================================================
+void testPlannedSeeds() {
+	const int K = 6;
+	const int MAX_OCCURRENCES = 100;
+	const string MOTIF = "ACGNAC";
+	mt19937 rng(39);
+	vector<Genome> genomes;
+	vector<pair<int, int>> motifPlaces;	// genome index and position of each planted motif
+	for (int g = 0; g < 6; g++) {
+		string dna = randomDna(rng, 3000);
+		for (size_t i = 0; i < dna.size(); i++) {
+			if (rng() % 40 == 0)
+				dna[i] = 'N';
+		}
+		for (int p = (int)(rng() % 40); p + (int)MOTIF.size() <= (int)dna.size(); p += 30 + (int)(rng() % 20)) {
+			dna.replace(p, MOTIF.size(), MOTIF);
+			motifPlaces.push_back(make_pair(g, p));
+		}
+		genomes.push_back(Genome("g" + to_string(g), dna));
+	}
+
+	const char *configs[] = { "no options", "masking", "Ns limit changed between genomes" };
+	for (int config = 0; config < 3; config++) {
+		GenomeMatcher library(K);
+		NaiveLibrary naive(K, config == 1 ? MAX_OCCURRENCES : 0);
+		if (config == 1)
+			library.setMaxSeedOccurrences(MAX_OCCURRENCES);
+		for (size_t g = 0; g < genomes.size(); g++) {
+			int maxNs = config == 2 ? (g < 2 ? -1 : g < 4 ? 1 : 0) : -1;
+			library.setMaxIndexedNs(maxNs);
+			library.addGenome(genomes[g]);
+			naive.addGenome(genomes[g], maxNs);
+		}
+
+		for (int frozen = 0; frozen < 2; frozen++) {
+			if (frozen)
+				library.freezeIndex();
+			int wrong = 0;
+			size_t found = 0;
+			mt19937 queries(config);
+			for (int q = 0; q < 300; q++) {
+				int maxMismatches = q % 3 == 0 ? 0 : 1 + q % 2;
+				int minimumLength = K + queries() % (maxMismatches * K + 8);	// at most MAX_PLANNED_RUNS runs
+				int length = minimumLength + queries() % 10;
+				pair<int, int> place = motifPlaces[queries() % motifPlaces.size()];
+				const Genome &genome = genomes[place.first];
+				int start = q % 2 ? place.second : queries() % (genome.length() - length);
+				string fragment;
+				if (!genome.extract(start, length, fragment))
+					continue;
+				for (int m = 0; m < maxMismatches; m++)
+					fragment[1 + queries() % (length - 1)] = "ACGT"[queries() % 4];
+
+				vector<DNAMatch> matches;
+				library.findGenomesWithMismatches(fragment, minimumLength, maxMismatches, matches);
+				if (!sameMatches(byName(matches), naive.find(fragment, minimumLength, maxMismatches)))
+					wrong++;
+				found += matches.size();
+			}
+			string when = string(" (") + configs[config] + (frozen ? ", frozen)" : ")");
+			check(wrong == 0, "seeding finds what a naive scan finds" + when);
+			check(found > 0, "the seeding queries find matches" + when);
+		}
+	}
+
+	// a fragment whose first k-mer has Ns is still found in a genome added before the limit
+	for (int frozen = 0; frozen < 2; frozen++) {
+		string repeats;
+		for (int i = 0; i < 100; i++)
+			repeats += "ANA";
+		GenomeMatcher library(3);
+		library.addGenome(Genome("repeats", repeats));
+		library.addGenome(Genome("target", "ANAGCTTGCATC"));
+		library.setMaxIndexedNs(0);
+		library.addGenome(Genome("later", "GGGGGGGG"));
+		if (frozen)
+			library.freezeIndex();
+		vector<DNAMatch> matches;
+		check(library.findGenomesWithThisDNA("ANAGCTTGCA", 10, true, matches) && matches.size() == 1 && matches[0].genomeName == "target",
+			string("a genome indexed before setMaxIndexedNs keeps its windows with Ns") + (frozen ? " (frozen)" : ""));
+	}
+}
+
+//=================================================================================================
+//	void testConcurrentWriter
+//	readers querying a concurrent library while another thread adds genomes to it each get the
+//	results of the library with some first n of the genomes, never of one in between, and once
+//	the writer is done the library gives what a library built on one thread gives
+//=================================================================================================
+void testConcurrentWriter() {
+	const int NUM_GENOMES = 8;
+	const int NUM_READERS = 3;
+	mt19937 rng(35);
+	vector<Genome> genomes;
+	for (int i = 0; i < NUM_GENOMES; i++)
+		genomes.push_back(Genome("g" + to_string(i), randomDna(rng, 3000)));
+	vector<string> fragments;
+	for (int i = 0; i < 40; i++) {
+		const Genome &genome = genomes[i % NUM_GENOMES];
+		string fragment;
+		genome.extract(rng() % (genome.length() - 40), 16 + rng() % 24, fragment);
+		if (i % 2)
+			fragment[1 + rng() % (fragment.size() - 1)] = "ACGT"[rng() % 4];
+		fragments.push_back(fragment);
+	}
+
+	// expected[n][q] is what a library of the first n genomes finds for fragments[q]
+	vector<vector<vector<DNAMatch>>> expected(NUM_GENOMES + 1, vector<vector<DNAMatch>>(fragments.size()));
+	for (int n = 0; n <= NUM_GENOMES; n++) {
+		GenomeMatcher serial(10);
+		for (int i = 0; i < n; i++)
+			serial.addGenome(genomes[i]);
+		for (size_t q = 0; q < fragments.size(); q++)
+			serial.findGenomesWithThisDNA(fragments[q], 10, q % 3 == 0, expected[n][q]);
+	}
+
+	GenomeMatcher library(10, 0, true);
+	atomic<bool> writing(true);
+	vector<int> wrong(NUM_READERS, 0);
+	vector<thread> readers;
+	for (int t = 0; t < NUM_READERS; t++) {
+		readers.emplace_back([&, t]() {
+			for (bool more = true; more; ) {
+				more = writing.load();	// finish one more pass once the writer is done
+				for (size_t q = 0; q < fragments.size(); q++) {
+					vector<DNAMatch> matches;
+					library.findGenomesWithThisDNA(fragments[q], 10, q % 3 == 0, matches);
+					bool snapshot = false;
+					for (int n = 0; n <= NUM_GENOMES && !snapshot; n++)
+						snapshot = sameMatches(matches, expected[n][q]);
+					if (!snapshot)
+						wrong[t]++;
+				}
+				vector<Genome> seen = library.genomes();
+				for (size_t i = 0; i < seen.size(); i++) {
+					if (i >= genomes.size() || seen[i].name() != genomes[i].name())
+						wrong[t]++;
+				}
+			}
+		});
+	}
+	for (int i = 0; i < NUM_GENOMES; i++) {
+		library.addGenome(genomes[i]);
+		this_thread::yield();
+	}
+	writing = false;
+	for (size_t t = 0; t < readers.size(); t++)
+		readers[t].join();
+
+	for (int t = 0; t < NUM_READERS; t++)
+		check(wrong[t] == 0, "each reader sees the library before or after each addGenome");
+	int different = 0;
+	for (size_t q = 0; q < fragments.size(); q++) {
+		vector<DNAMatch> matches;
+		library.findGenomesWithThisDNA(fragments[q], 10, q % 3 == 0, matches);
+		if (!sameMatches(matches, expected[NUM_GENOMES][q]))
+			different++;
+	}
+	check(different == 0, "a library built while being read matches one built on one thread");
+}
+
+//=================================================================================================
+//	void testBatchQueries
+//	the batch queries give each fragment the matches its single query gives, in the same order,
+//	and return true exactly when some single query does, exact and with SNiPs, live and frozen
+//=================================================================================================
+void testBatchQueries() {
+	mt19937 rng(26);
+	vector<Genome> genomes;
+	for (int i = 0; i < 6; i++) {
+		string dna = randomDna(rng, 4000);
+		dna.replace(1000, 300, dna.substr(0, 300));	// a repeat, so some fragments match twice
+		genomes.push_back(Genome("g" + to_string(i), dna));
+	}
+	vector<string> fragments;
+	for (int i = 0; i < 150; i++) {
+		const Genome &genome = genomes[rng() % genomes.size()];
+		string fragment;
+		genome.extract(rng() % (genome.length() - 40), 8 + rng() % 32, fragment);
+		for (int m = rng() % 3; m > 0; m--)
+			fragment[1 + rng() % (fragment.size() - 1)] = "ACGT"[rng() % 4];
+		fragments.push_back(fragment);
+	}
+	fragments.push_back(fragments[0]);	// a fragment asked for twice
+	fragments.push_back("ACGTACG");	// shorter than minimumLength
+	fragments.push_back("");
+	fragments.push_back(randomDna(rng, 30));	// most likely found nowhere
+
+	GenomeMatcher library(10);
+	for (size_t i = 0; i < genomes.size(); i++)
+		library.addGenome(genomes[i]);
+	for (int frozen = 0; frozen < 2; frozen++) {
+		if (frozen)
+			library.freezeIndex();
+		for (int maxMismatches = 0; maxMismatches <= 2; maxMismatches++) {
+			vector<vector<DNAMatch>> batch;
+			bool batchFound = maxMismatches < 2 ? library.findGenomesWithThisDNABatch(fragments, 10, maxMismatches == 0, batch)
+				: library.findGenomesWithMismatchesBatch(fragments, 10, maxMismatches, batch);
+			bool anyFound = false;
+			int different = 0;
+			for (size_t i = 0; i < fragments.size(); i++) {
+				vector<DNAMatch> single;
+				if (maxMismatches < 2)
+					anyFound = library.findGenomesWithThisDNA(fragments[i], 10, maxMismatches == 0, single) || anyFound;
+				else
+					anyFound = library.findGenomesWithMismatches(fragments[i], 10, maxMismatches, single) || anyFound;
+				if (i >= batch.size() || !sameMatches(batch[i], single))
+					different++;
+			}
+
+			string when = " (" + to_string(maxMismatches) + " mismatches" + (frozen ? ", frozen)" : ")");
+			check(batch.size() == fragments.size(), "the batch has a result per fragment" + when);
+			check(different == 0, "each batch result is the single query's result" + when);
+			check(batchFound == anyFound, "the batch finds something when a single query does" + when);
+		}
+	}
+}
+
+//=================================================================================================
+//	string reverseComplement
+//	returns dna read backward with each base swapped for its pair
+//=================================================================================================
+string reverseComplement(const string &dna) {
+	string complement(dna.rbegin(), dna.rend());
+	for (size_t i = 0; i < complement.size(); i++) {
+		switch (complement[i]) {
+		case 'A': complement[i] = 'T'; break;
+		case 'T': complement[i] = 'A'; break;
+		case 'C': complement[i] = 'G'; break;
+		case 'G': complement[i] = 'C'; break;
+		}
+	}
+	return complement;
+}
+
+//=================================================================================================
+//	void testBothStrands
+//	a fragment planted reverse complemented is found on the reverse strand only when both strands
+//	are searched, a genome holding the fragment both ways keeps its forward match even where the
+//	reverse one comes first, and the result cache keeps the two kinds of query apart
+//=================================================================================================
+void testBothStrands() {
+	mt19937 rng(46);
+	string fragment = randomDna(rng, 30);
+	string forward = randomDna(rng, 2000), reverse = randomDna(rng, 2000), both = randomDna(rng, 2000);
+	forward.replace(700, fragment.size(), fragment);
+	reverse.replace(400, fragment.size(), reverseComplement(fragment));
+	both.replace(100, fragment.size(), reverseComplement(fragment));	// before the forward copy
+	both.replace(1500, fragment.size(), fragment);
+
+	for (int frozen = 0; frozen < 2; frozen++) {
+		GenomeMatcher library(10);
+		library.addGenome(Genome("forward", forward));
+		library.addGenome(Genome("reverse", reverse));
+		library.addGenome(Genome("both", both));
+		if (frozen)
+			library.freezeIndex();
+		string when = frozen ? " (frozen)" : "";
+
+		vector<DNAMatch> oneStrand, bothStrands;
+		library.findGenomesWithThisDNA(fragment, 20, true, oneStrand);
+		library.findGenomesWithThisDNA(fragment, 20, true, bothStrands, true);
+		oneStrand = byName(oneStrand);
+		bothStrands = byName(bothStrands);
+		check(oneStrand.size() == 2 && oneStrand[0].genomeName == "both" && oneStrand[1].genomeName == "forward",
+			"one strand finds only the forward copies" + when);
+		check(bothStrands.size() == 3, "both strands find every copy" + when);
+		if (bothStrands.size() == 3) {
+			check(bothStrands[2].genomeName == "reverse" && bothStrands[2].reverseStrand && bothStrands[2].position == 400
+				&& bothStrands[2].length == 30, "the reverse copy is reported on the reverse strand where it starts" + when);
+			check(bothStrands[1].genomeName == "forward" && !bothStrands[1].reverseStrand && bothStrands[1].position == 700,
+				"the forward copy is reported on the forward strand" + when);
+			check(bothStrands[0].genomeName == "both" && !bothStrands[0].reverseStrand && bothStrands[0].position == 1500,
+				"a tie between the strands goes to the forward one" + when);
+		}
+
+		library.setResultCacheCapacity(10);
+		vector<DNAMatch> cachedOne, cachedBoth;
+		library.findGenomesWithThisDNA(fragment, 20, true, cachedOne);
+		library.findGenomesWithThisDNA(fragment, 20, true, cachedBoth, true);
+		check(library.resultCacheHits() == 0 && library.resultCacheMisses() == 2, "bothStrands is part of the cache key" + when);
+		cachedOne.clear();
+		cachedBoth.clear();
+		library.findGenomesWithThisDNA(fragment, 20, true, cachedOne);
+		library.findGenomesWithThisDNA(fragment, 20, true, cachedBoth, true);
+		check(library.resultCacheHits() == 2 && sameMatches(byName(cachedOne), oneStrand) && sameMatches(byName(cachedBoth), bothStrands),
+			"each strand option gets its own cached result" + when);
+
+		vector<GenomeMatch> related;
+		Genome query("query", reverseComplement(reverse.substr(200, 600)));
+		check(!library.findRelatedGenomes(query, 20, true, 50, related), "a reverse complemented genome is not related on one strand" + when);
+		check(library.findRelatedGenomes(query, 20, true, 50, related, true) && related.size() == 1 && related[0].genomeName == "reverse"
+			&& related[0].percentMatch == 100, "a reverse complemented genome is related on both strands" + when);
+	}
+}
+
+//=================================================================================================
+//	void testMergedParts
+//	a library filled from parts that its createEmptyCopy made, each built on a thread of its own
+//	and one of them frozen, answers like a library given every genome on one thread with the same
+//	Ns limit, sketches and prefilter, whether it is concurrent or not
+//=================================================================================================
+void testMergedParts() {
+	mt19937 rng(49);
+	vector<Genome> genomes;
+	for (int i = 0; i < 6; i++) {
+		string dna = randomDna(rng, 3000);
+		dna.replace(rng() % 2900, 6, "NNNNNN");
+		genomes.push_back(Genome("g" + to_string(i), dna));
+	}
+	vector<string> fragments;
+	for (int i = 0; i < 30; i++) {
+		const Genome &genome = genomes[i % genomes.size()];
+		string fragment;
+		genome.extract(rng() % (genome.length() - 40), 16 + rng() % 24, fragment);
+		if (i % 3 == 1)
+			fragment[1 + rng() % (fragment.size() - 1)] = 'N';
+		fragments.push_back(fragment);
+	}
+	string query;
+	genomes[3].extract(500, 1200, query);
+
+	GenomeMatcher serial(10, 4);
+	serial.setMaxIndexedNs(2);
+	serial.setRelatedPrefilter(8);
+	for (size_t i = 0; i < genomes.size(); i++)
+		serial.addGenome(genomes[i]);
+
+	for (int concurrent = 0; concurrent < 2; concurrent++) {
+		string which = concurrent ? " (concurrent)" : "";
+		GenomeMatcher library(10, 4, concurrent != 0);
+		library.setMaxIndexedNs(2);
+		library.setRelatedPrefilter(8);
+		library.addGenome(genomes[0]);
+
+		unique_ptr<GenomeMatcher> parts[2] = { unique_ptr<GenomeMatcher>(library.createEmptyCopy()), unique_ptr<GenomeMatcher>(library.createEmptyCopy()) };
+		thread first([&]() { for (int i = 1; i < 4; i++) parts[0]->addGenome(genomes[i]); parts[0]->freezeIndex(); });
+		thread second([&]() { for (int i = 4; i < 6; i++) parts[1]->addGenome(genomes[i]); });
+		first.join();
+		second.join();
+		library.addGenomesFrom(*parts[0]);
+		library.addGenomesFrom(*parts[1]);
+		check(parts[0]->genomes().empty() && parts[1]->genomes().empty(), "addGenomesFrom empties the parts" + which);
+
+		vector<Genome> added = library.genomes();
+		bool inOrder = added.size() == genomes.size();
+		for (size_t i = 0; inOrder && i < added.size(); i++)
+			inOrder = added[i].name() == genomes[i].name();
+		check(inOrder, "merged parts keep the order the genomes were added in" + which);
+
+		int different = 0;
+		for (size_t q = 0; q < fragments.size(); q++) {
+			vector<DNAMatch> expected, matches;
+			serial.findGenomesWithThisDNA(fragments[q], 10, q % 2 == 0, expected);
+			library.findGenomesWithThisDNA(fragments[q], 10, q % 2 == 0, matches);
+			if (!sameMatches(matches, expected))
+				different++;
+		}
+		check(different == 0, "merged parts find what a library built on one thread finds" + which);
+
+		vector<GenomeMatch> expectedRelated, related, expectedSketch, sketch;
+		serial.findRelatedGenomes(Genome("query", query), 40, true, 5, expectedRelated);
+		library.findRelatedGenomes(Genome("query", query), 40, true, 5, related);
+		serial.findRelatedGenomesSketch(Genome("query", query), 40, true, 5, 2, expectedSketch);
+		library.findRelatedGenomesSketch(Genome("query", query), 40, true, 5, 2, sketch);
+		bool sameRelated = !related.empty() && related.size() == expectedRelated.size() && sketch.size() == expectedSketch.size();
+		for (size_t i = 0; sameRelated && i < related.size(); i++)
+			sameRelated = related[i].genomeName == expectedRelated[i].genomeName && related[i].percentMatch == expectedRelated[i].percentMatch;
+		for (size_t i = 0; sameRelated && i < sketch.size(); i++)
+			sameRelated = sketch[i].genomeName == expectedSketch[i].genomeName && sketch[i].percentMatch == expectedSketch[i].percentMatch;
+		check(sameRelated, "merged parts keep their sketches and k-mer filters" + which);
+	}
+}
+
+int main()
+{
+	testTrieAlphabet();
+	testTrieKeyLength();
+	testGenomeAlphabet();
+	testConcurrentCache();
+	testConcurrentWriter();
+	testPlannedSeeds();
+	testBatchQueries();
+	testBothStrands();
+	testMergedParts();
+	if (g_failures > 0) {
+		cerr << g_failures << " checks failed" << endl;
+		return 1;
+	}
+	cerr << "All checks passed" << endl;
+	return 0;
+}